@@ -0,0 +1,63 @@
+#include "AllocationCounter.h"
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+using namespace ph;
+
+static std::atomic<size_t> g_nAllocations(0);
+
+void ph::AllocationCounter::reset()
+{
+	g_nAllocations = 0;
+}
+
+size_t ph::AllocationCounter::count()
+{
+	return g_nAllocations;
+}
+
+// replace the global allocation functions so every heap allocation in the process is counted
+void* operator new(std::size_t size)
+{
+	g_nAllocations++;
+	if (void* p = std::malloc(size ? size : 1))
+		return p;
+	throw std::bad_alloc();
+}
+
+void* operator new[](std::size_t size)
+{
+	return operator new(size);
+}
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept
+{
+	g_nAllocations++;
+	return std::malloc(size ? size : 1);
+}
+
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept
+{
+	return operator new(size, std::nothrow);
+}
+
+void operator delete(void* p) noexcept
+{
+	std::free(p);
+}
+
+void operator delete[](void* p) noexcept
+{
+	std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept
+{
+	std::free(p);
+}
+
+void operator delete[](void* p, std::size_t) noexcept
+{
+	std::free(p);
+}
@@ -0,0 +1,13 @@
+#pragma once
+#include <cstddef>
+
+namespace ph
+{
+	class AllocationCounter
+	{
+		// counts calls to the global operator new in the benchmark executable
+	public:
+		static void reset();
+		static size_t count();
+	};
+}
@@ -0,0 +1,352 @@
+#include <opencv2/imgproc.hpp>
+#include <opencv2/core.hpp>
+#include <iostream>
+#include <fstream>
+#include <chrono>
+#include <algorithm>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include "AllocationCounter.h"
+#include "particle/FrameRenderer.h"
+#include "particle/ParticleFinder.h"
+#include "ray/OpticalLayer.h"
+#include "ray/OpticalPattern.h"
+#include "ray/OpticalScene.h"
+#include "ray/OpticalSphere.h"
+
+using namespace ph;
+
+struct benchResult
+{
+	std::string sName;
+	std::string sSize;  // input size the kernel ran on
+	double dNsPerOp;
+	double dPixelsPerSecond;  // zero for kernels that don't work on images
+	double dAllocsPerOp;  // heap allocations through operator new, opencv's buffers use its own allocator and aren't counted
+};
+
+std::vector<benchResult> vecResults;
+
+template <class F>
+benchResult runBenchmark(unsigned nOps, F op)
+{
+	// run once to warm up any scratch space, then time nOps calls and count the heap allocations they make
+	op(0);
+
+	AllocationCounter::reset();
+	auto startTime = std::chrono::high_resolution_clock::now();
+	for (unsigned i = 0; i < nOps; ++i)
+		op(i);
+	auto endTime = std::chrono::high_resolution_clock::now();
+	size_t nAllocs = AllocationCounter::count();
+
+	benchResult r;
+	r.dNsPerOp = (double)std::chrono::duration_cast<std::chrono::nanoseconds>(endTime - startTime).count() / nOps;
+	r.dPixelsPerSecond = 0;
+	r.dAllocsPerOp = (double)nAllocs / nOps;
+	return r;
+}
+
+void addResult(const std::string& sName, const std::string& sSize, double dPixelsPerOp, benchResult r)
+{
+	// record the result and print it
+	r.sName = sName;
+	r.sSize = sSize;
+	if (dPixelsPerOp > 0)
+		r.dPixelsPerSecond = dPixelsPerOp * 1e9 / r.dNsPerOp;
+	vecResults.push_back(r);
+
+	std::cout << sName << " [" << sSize << "]: " << r.dNsPerOp << " ns/op, ";
+	if (dPixelsPerOp > 0)
+		std::cout << r.dPixelsPerSecond / 1e6 << " Mpixels/s, ";
+	std::cout << r.dAllocsPerOp << " allocations/op" << std::endl;
+}
+
+bool writeJSON(const std::string& sFile, unsigned nOps)
+{
+	// one record per kernel and size so the results of two builds can be diffed
+	std::ofstream file(sFile);
+	if (!file.is_open())
+		return false;
+
+	file << "{\n  \"ops\": " << nOps << ",\n  \"benchmarks\": [\n";
+	for (size_t i = 0; i < vecResults.size(); i++)
+	{
+		const benchResult& r = vecResults[i];
+		file << "    {\"name\": \"" << r.sName << "\", \"size\": \"" << r.sSize << "\", \"ns_per_op\": " << r.dNsPerOp
+			<< ", \"pixels_per_second\": " << r.dPixelsPerSecond << ", \"allocations_per_op\": " << r.dAllocsPerOp << "}"
+			<< ((i + 1 < vecResults.size()) ? ",\n" : "\n");
+	}
+	file << "  ]\n}\n";
+	return file.good();
+}
+
+std::string sizeName(cv::Size size)
+{
+	return std::to_string(size.width) + "x" + std::to_string(size.height);
+}
+
+cv::Mat makeSpeckle(cv::Size size)
+{
+	// synthetic speckle pattern to use as the reference image
+	cv::Mat matSpeckle(size, CV_8UC1);
+	cv::randu(matSpeckle, cv::Scalar(0), cv::Scalar(256));
+	cv::GaussianBlur(matSpeckle, matSpeckle, cv::Size(5, 5), 1.5);
+	return matSpeckle;
+}
+
+std::vector<vf3> makeParticles(cv::Size size, const Settings& settings, float z)
+{
+	// particles on a grid over the frame, every other row shifted so neighbors overlap
+	std::vector<vf3> vecPositions;
+	float r = settings.fParticleRadiusPx;
+	for (float y = 1.5f * r; y < size.height - 1.5f * r; y += 2.5f * r)
+		for (float x = 1.5f * r + ((int)(y / r) % 2) * r; x < size.width - 1.5f * r; x += 3 * r)
+			vecPositions.push_back(vf3(Particle::pxToReal(x), Particle::pxToReal(y), z));
+	return vecPositions;
+}
+
+void renderParticle(const ImageProcessor& imProcessor, const Settings& settings, const Particle& p, cv::Mat matParticle)
+{
+	// draw the analytically transformed ref image into the DIC region of the particle
+	float posX, posY;
+	p.getPositionPx(posX, posY);
+	cv::Rect rectRegion((int)posX - (settings.nDICRegionSize >> 1), (int)posY - (settings.nDICRegionSize >> 1), settings.nDICRegionSize, settings.nDICRegionSize);
+	applyTransformSingle(&p, &settings, [&](const auto& t) { return imProcessor.transformRef(rectRegion, t); }).copyTo(matParticle(rectRegion));
+}
+
+void benchTransforms(unsigned nOps)
+{
+	Settings settings;
+	Particle::setSettings(&settings);
+	float z = settings.fChannelWallThickness + 0.4f * settings.fChannelHeight;
+
+	for (int nRegion : { 41, 61, 81 })
+	{
+		Particle p;
+		p.setSizeCorrelation(nRegion);
+		p.setPosition(vf3(Particle::pxToReal(320), Particle::pxToReal(240), z));
+		std::string sSize = std::to_string(nRegion) + "x" + std::to_string(nRegion);
+
+		// one op transforms every pixel of the DIC region
+		auto transformRegion = [&](const auto& t)
+		{
+			return runBenchmark(nOps, [&](unsigned i)
+				{
+					for (int y = 0; y < nRegion; y++)
+						for (int x = 0; x < nRegion; x++)
+						{
+							int pxPosX = x, pxPosY = y;
+							t(pxPosX, pxPosY);
+						}
+				});
+		};
+		addResult("TransformSingle", sSize, nRegion * nRegion, transformRegion(TransformSingle(&p, &settings)));
+		addResult("TransformSingleFast", sSize, nRegion * nRegion, applyTransformSingle(&p, &settings, transformRegion, true));
+
+		// the fast transform tabulates the analytic radius once per pixel of radius, so its construction times the analytic model
+		int nRadii = (int)(0.707107f * nRegion + 1) + 1;
+		benchResult r = runBenchmark(nOps, [&](unsigned i) { TransformSingle t(&p, &settings, true); });
+		r.dNsPerOp /= nRadii;
+		r.dAllocsPerOp /= nRadii;
+		addResult("getTransformedRadiusAnalytic", sSize, 0, r);
+	}
+}
+
+void benchRayTracing(unsigned nOps)
+{
+	Settings settings;
+	Particle::setSettings(&settings);
+	float z = settings.fChannelWallThickness + 0.4f * settings.fChannelHeight;
+	float r = Particle::pxToReal(settings.fParticleRadiusPx);
+
+	// rays through the center particle of a row of 1, 2 or 4 overlapping particles
+	for (int nParticles : { 1, 2, 4 })
+	{
+		OpticalScene scene(settings.fEtaLiquid);
+		scene.addMedium(std::make_shared<OpticalPattern>(vf3(0, 0, 0), vf3(0, 0, 1)));
+		scene.addMedium(std::make_shared<OpticalLayer>(vf3(0, 0, 0), vf3(0, 0, settings.fChannelWallThickness), vf3(0, 0, 1), settings.fEtaGlass));
+		for (int i = 0; i < nParticles; i++)
+			scene.addMedium(std::make_shared<OpticalSphere>(vf3(5 + 1.2f * r * i, 5, z), r, settings.fEtaParticle));
+
+		addResult("getRayTermination", std::to_string(nParticles) + " particles", 0, runBenchmark(nOps * 100, [&](unsigned i)
+			{
+				Ray ray(vf3(5 + 0.9f * r * ((i % 200) / 100.0f - 1), 5, 5), vf3(0, 0, -1));
+				scene.getRayTermination(ray);
+			}));
+	}
+}
+
+void benchRegions(unsigned nOps)
+{
+	Settings settings;
+	Particle::setSettings(&settings);
+	cv::Mat matRef = makeSpeckle(cv::Size(640, 480));
+	ImageProcessor imProcessor(matRef, &settings);
+	float z = settings.fChannelWallThickness + 0.4f * settings.fChannelHeight;
+
+	for (int nRegion : { 41, 61, 81 })
+	{
+		Particle p;
+		p.setSizeCorrelation(nRegion);
+		p.setPosition(vf3(Particle::pxToReal(320), Particle::pxToReal(240), z));
+		cv::Rect rectRegion(320 - (nRegion >> 1), 240 - (nRegion >> 1), nRegion, nRegion);
+		std::string sSize = std::to_string(nRegion) + "x" + std::to_string(nRegion);
+		settings.nDICRegionSize = nRegion;
+		cv::Mat matParticle = matRef.clone();
+		renderParticle(imProcessor, settings, p, matParticle);
+
+		cv::Mat matTransformed;
+		addResult("transformRef", sSize, nRegion * nRegion, applyTransformSingle(&p, &settings, [&](const auto& t)
+			{
+				return runBenchmark(nOps, [&](unsigned i) { imProcessor.transformRef(rectRegion, t, matTransformed); });
+			}, true));
+		addResult("correlateTransform", sSize, nRegion * nRegion, applyTransformSingle(&p, &settings, [&](const auto& t)
+			{
+				return runBenchmark(nOps, [&](unsigned i) { imProcessor.correlateTransform(t, rectRegion, matParticle, matTransformed); });
+			}, true));
+	}
+}
+
+void benchImages(unsigned nOps)
+{
+	Settings settings;
+	Particle::setSettings(&settings);
+	float z = settings.fChannelWallThickness + 0.4f * settings.fChannelHeight;
+
+	for (cv::Size size : { cv::Size(320, 240), cv::Size(640, 480), cv::Size(1280, 960) })
+	{
+		// frames of particles rendered over a speckle pattern, shifted slightly so they need aligning
+		cv::Mat matRef = makeSpeckle(size);
+		ImageProcessor imProcessor(matRef, &settings);
+		FrameRenderer renderer(matRef, &settings);
+		cv::Mat matFrame, matShifted, matWork;
+		renderer.render(makeParticles(size, settings, z), matFrame);
+		cv::Mat matShift = (cv::Mat_<float>(2, 3) << 1, 0, 1.5f, 0, 1, -0.5f);
+		cv::warpAffine(matFrame, matShifted, matShift, size, cv::INTER_LINEAR, cv::BORDER_REPLICATE);
+
+		// the binarized frame as the particle finder sees it, and its distance transform for the reconstruction
+		cv::Mat matMask = matFrame.clone();
+		imProcessor.subtractBackground(matMask);
+		cv::Mat matSubtracted = matMask.clone();
+		imProcessor.morphClose(matMask);
+		imProcessor.morphOpen(matMask);
+		cv::Mat matDist, matMarker;
+		cv::distanceTransform(matMask, matDist, cv::DIST_L2, cv::DIST_MASK_PRECISE);
+		matMarker = cv::max(0, matDist - 0.0001 * settings.nHMaxParam);
+
+		// kernels that work in place get a fresh copy of their input each op
+		unsigned nImageOps = std::max(1u, (unsigned)(nOps * 640.0 * 480.0 / size.area() / 100));
+		double dPixels = size.area();
+		std::string sSize = sizeName(size);
+		addResult("subtractBackground", sSize, dPixels, runBenchmark(nImageOps, [&](unsigned i)
+			{
+				matFrame.copyTo(matWork);
+				imProcessor.subtractBackground(matWork);
+			}));
+		addResult("morphCloseOpen", sSize, dPixels, runBenchmark(nImageOps, [&](unsigned i)
+			{
+				matSubtracted.copyTo(matWork);
+				imProcessor.morphClose(matWork);
+				imProcessor.morphOpen(matWork);
+			}));
+		addResult("morphReconstruct", sSize, dPixels, runBenchmark(nImageOps, [&](unsigned i) { imProcessor.morphReconstruct(matMarker, matDist); }));
+		addResult("findCirclesEDT", sSize, dPixels, runBenchmark(nImageOps, [&](unsigned i)
+			{
+				matMask.copyTo(matWork);
+				imProcessor.findCirclesEDT(matWork);
+			}));
+		addResult("alignToRef", sSize, dPixels, runBenchmark(std::max(1u, nImageOps / 4), [&](unsigned i)
+			{
+				matShifted.copyTo(matWork);
+				imProcessor.alignToRef(matWork);
+			}));
+	}
+}
+
+void benchObjectives(unsigned nOps)
+{
+	Settings settings;
+	Particle::setSettings(&settings);
+
+	cv::Mat matRef = makeSpeckle(cv::Size(640, 480));
+	ImageProcessor imProcessor(matRef, &settings);
+	float z = settings.fChannelWallThickness + 0.4f * settings.fChannelHeight;
+	std::string sSize = std::to_string(settings.nDICRegionSize) + "x" + std::to_string(settings.nDICRegionSize);
+
+	// single particle objective (analytical transform)
+	{
+		Particle p;
+		p.setPosition(vf3(Particle::pxToReal(320), Particle::pxToReal(240), z));
+		cv::Mat matParticle = matRef.clone();
+		renderParticle(imProcessor, settings, p, matParticle);
+
+		EvalWorkspace workspace(&settings);
+		dataCorrelate data{ &imProcessor, &settings, &matParticle, nullptr, 0, &workspace, -INFINITY };
+		double pos[3] = { p.getPositionReal().x, p.getPositionReal().y, z };
+		addResult("correlateSingleParticle", sSize, 0, runBenchmark(nOps, [&](unsigned i)
+			{
+				pos[2] = z + 0.001 * (i % 100);
+				correlateSingleParticle(3, pos, nullptr, &data);
+			}));
+	}
+
+	// group objective (ray traced transform) with two overlapping particles
+	{
+		Particle p1, p2;
+		p1.setPosition(vf3(Particle::pxToReal(290), Particle::pxToReal(240), z));
+		p2.setPosition(vf3(Particle::pxToReal(350), Particle::pxToReal(240), z));
+		p1.addNeighbor(&p2);
+		p2.addNeighbor(&p1);
+		cv::Mat matParticle = matRef.clone();
+		renderParticle(imProcessor, settings, p1, matParticle);
+		renderParticle(imProcessor, settings, p2, matParticle);
+
+		EvalWorkspace workspace(&settings);
+		std::vector<Particle*> vecpGroup = { &p1, &p2 };
+		OpticalScene& scene = workspace.buildScene(vecpGroup);
+		dataCorrelate data{ &imProcessor, &settings, &matParticle, &scene, 0, &workspace, -INFINITY };
+		double pos[6] = { p1.getPositionReal().x, p1.getPositionReal().y, z, p2.getPositionReal().x, p2.getPositionReal().y, z };
+		addResult("correlateGroupParticle", sSize, 0, runBenchmark(nOps / 10 + 1, [&](unsigned i)
+			{
+				pos[2] = z + 0.001 * (i % 100);
+				correlateGroupParticle(6, pos, nullptr, &data);
+			}));
+	}
+}
+
+int main(int argc, char** argv)
+{
+	// ph_bench [nOps] [-json results.json] [-filter name]
+	unsigned nOps = 2000;
+	std::string sJSON = "", sFilter = "";
+	for (int i = 1; i < argc; i++)
+	{
+		std::string arg(argv[i]);
+		if (arg == "-json" && i + 1 < argc)
+			sJSON = argv[++i];
+		else if (arg == "-filter" && i + 1 < argc)
+			sFilter = argv[++i];
+		else
+			nOps = std::max(1, atoi(argv[i]));
+	}
+
+	// kernels are timed on a single thread so the numbers compare between machines
+	cv::setNumThreads(1);
+
+	auto selected = [&](const char* group) { return sFilter == "" || sFilter == group; };
+	if (selected("transforms")) benchTransforms(nOps);
+	if (selected("rays")) benchRayTracing(nOps);
+	if (selected("regions")) benchRegions(nOps);
+	if (selected("images")) benchImages(nOps);
+	if (selected("objectives")) benchObjectives(nOps);
+
+	if (sJSON != "" && !writeJSON(sJSON, nOps))
+	{
+		std::cerr << "failed to write " << sJSON << std::endl;
+		return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,334 @@
+#include "FrameSource.h"
+#include <opencv2/imgproc.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+using namespace ph;
+
+namespace
+{
+	bool isFourcc(const char* id, const char* fourcc) { return std::memcmp(id, fourcc, 4) == 0; }
+
+	uint32_t getU32(const unsigned char* p) { return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24); }
+	uint16_t getU16(const unsigned char* p) { return p[0] | (p[1] << 8); }
+}
+
+bool ph::FrameSource::open(const std::string& file)
+{
+	release();
+	if (FrameStack::isFrameStack(file))
+		return m_stack.open(file);
+	if (m_openAVI(file))
+		return true;
+
+	// not an avi we can read directly, so let opencv decode it but skip the conversion to bgr
+	if (!m_cap.open(file))
+		return false;
+	m_cap.set(cv::CAP_PROP_CONVERT_RGB, 0);
+	return true;
+}
+
+bool ph::FrameSource::read(cv::Mat& matFrame)
+{
+	// each frame gets its own buffer, callers keep earlier frames that may share the passed header
+	matFrame.release();
+	m_dConvertMs = 0;
+
+	if (m_stack.isOpened())
+	{
+		if (m_nNextFrame >= m_stack.getFrameCount())
+			return false;
+		m_dAlignment = m_stack.getAlignment(m_nNextFrame).fCorrelation;
+		m_stack.getFrame(m_nNextFrame++, matFrame);
+		return true;
+	}
+
+	if (!m_bNative)
+	{
+		if (!m_cap.read(matFrame) || matFrame.empty())
+			return false;
+
+		auto startTime = std::chrono::high_resolution_clock::now();
+		if (matFrame.channels() == 3)
+			cv::cvtColor(matFrame, matFrame, cv::COLOR_BGR2GRAY);
+		else if (matFrame.channels() == 4)
+			cv::cvtColor(matFrame, matFrame, cv::COLOR_BGRA2GRAY);
+		m_dConvertMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - startTime).count();
+		return true;
+	}
+
+	uint32_t nSize;
+	if (!m_findFrameChunk(nSize))
+		return false;
+
+	if (nSize == 0)
+	{
+		// an empty chunk is a dropped frame, which repeats the previous frame like cv::VideoCapture so the frame numbers still match
+		if (m_posPrevious < 0)
+		{
+			matFrame = cv::Mat::zeros(m_nHeight, m_nWidth, CV_8UC1);
+			return true;
+		}
+		std::streampos pos = m_file.tellg();
+		m_file.seekg(m_posPrevious);
+		bool bOK = m_readFrameChunk(m_nPreviousSize, matFrame);
+		m_file.seekg(pos);
+		return bOK && (bool)m_file;
+	}
+
+	m_posPrevious = m_file.tellg();
+	m_nPreviousSize = nSize;
+	return m_readFrameChunk(nSize, matFrame);
+}
+
+bool ph::FrameSource::m_readFrameChunk(uint32_t nSize, cv::Mat& matFrame)
+{
+	// read the frame whose chunk data starts at the current position and move past the chunk
+	// a chunk too short for the frame, or cut off by the end of the file, isn't the end of the video
+	uint32_t nFrameBytes = (uint32_t)m_nStride * m_nHeight;
+	if (nSize < nFrameBytes)
+	{
+		m_bDamaged = true;
+		return false;
+	}
+
+	matFrame.create(m_nHeight, m_nWidth, CV_8UC1);
+	if (m_nStride == m_nWidth && !m_bBottomUp)
+		m_file.read((char*)matFrame.data, nFrameBytes);
+	else
+	{
+		for (int y = 0; y < m_nHeight; y++)
+		{
+			m_file.read((char*)matFrame.ptr(m_bBottomUp ? m_nHeight - 1 - y : y), m_nWidth);
+			m_file.seekg(m_nStride - m_nWidth, std::ios::cur);
+		}
+	}
+	m_file.seekg((std::streamoff)(nSize - nFrameBytes) + (nSize & 1), std::ios::cur);  // rest of the chunk and its padding
+
+	m_bDamaged = !m_file;
+	return !m_bDamaged;
+}
+
+bool ph::FrameSource::skip(int nFrames)
+{
+	// move past frames without decoding or converting them where the format allows, returns false if the video ends first
+	m_dConvertMs = 0;
+	if (m_stack.isOpened())
+	{
+		bool bOK = (m_nNextFrame + nFrames <= m_stack.getFrameCount());
+		m_nNextFrame = std::min(m_nNextFrame + nFrames, m_stack.getFrameCount());
+		return bOK;
+	}
+
+	for (int i = 0; i < nFrames; i++)
+	{
+		if (!m_bNative)
+		{
+			if (!m_cap.grab())
+				return false;
+			continue;
+		}
+
+		uint32_t nSize;
+		if (!m_findFrameChunk(nSize))
+			return false;
+		if (nSize > 0)
+		{
+			m_posPrevious = m_file.tellg();
+			m_nPreviousSize = nSize;
+		}
+		m_skip(nSize);
+	}
+	return true;
+}
+
+void ph::FrameSource::release()
+{
+	if (m_file.is_open())
+		m_file.close();
+	m_file.clear();
+	m_cap.release();
+	m_stack.close();
+	m_bNative = false;
+	m_nVideoStream = -1;
+	m_posPrevious = -1;
+	m_nPreviousSize = 0;
+	m_bDamaged = false;
+	m_nNextFrame = 0;
+}
+
+bool ph::FrameSource::m_openAVI(const std::string& file)
+{
+	m_file.open(file, std::ios::binary);
+	if (!m_file.is_open())
+		return false;
+
+	char id[4], type[4];
+	uint32_t nSize;
+	if (!m_readChunkHeader(id, nSize) || !isFourcc(id, "RIFF") || !m_file.read(type, 4) || !isFourcc(type, "AVI "))
+	{
+		release();
+		return false;
+	}
+
+	// walk the header lists until the movi list, where the frames start
+	int nStream = -1;
+	bool bFormatOK = false;
+	while (m_readChunkHeader(id, nSize))
+	{
+		if (isFourcc(id, "LIST"))
+		{
+			if (nSize < 4 || !m_file.read(type, 4))
+				break;
+			if (isFourcc(type, "movi"))
+			{
+				m_bNative = bFormatOK && m_checkFrameSize();
+				break;
+			}
+			if (!isFourcc(type, "hdrl") && !isFourcc(type, "strl"))
+				m_skip(nSize - 4);
+		}
+		else if (isFourcc(id, "strh"))
+		{
+			// stream header, the first video stream is the one we read
+			nStream++;
+			char fccType[4];
+			if (nSize < 4 || !m_file.read(fccType, 4))
+				break;
+			if (isFourcc(fccType, "vids") && m_nVideoStream < 0)
+				m_nVideoStream = nStream;
+			m_skip(nSize - 4);
+		}
+		else if (isFourcc(id, "strf") && nStream >= 0 && nStream == m_nVideoStream)
+			bFormatOK = m_parseFormat(nSize);
+		else
+			m_skip(nSize);
+	}
+
+	if (!m_bNative)
+	{
+		release();
+		return false;
+	}
+	return true;
+}
+
+bool ph::FrameSource::m_parseFormat(uint32_t nSize)
+{
+	// BITMAPINFOHEADER of the video stream followed by the palette
+	std::vector<unsigned char> vecFormat(nSize + (nSize & 1));
+	if (nSize < 40 || !m_file.read((char*)vecFormat.data(), vecFormat.size()))
+		return false;
+
+	const unsigned char* p = vecFormat.data();
+	uint32_t nHeaderSize = getU32(p);
+	int32_t nWidth = (int32_t)getU32(p + 4);
+	int32_t nHeight = (int32_t)getU32(p + 8);
+	uint16_t nBitCount = getU16(p + 14);
+	const char* compression = (const char*)p + 16;
+	uint32_t nColorsUsed = getU32(p + 32);
+	if (nBitCount != 8 || nWidth <= 0 || nHeight == 0)
+		return false;
+
+	m_nWidth = nWidth;
+	m_nHeight = std::abs(nHeight);
+	if (getU32(p + 16) == 0)
+	{
+		// BI_RGB frames are padded to 4 byte rows and bottom up unless the height is negative
+		// the palette has to be a plain gray ramp for the indices to be the intensities
+		m_nStride = (m_nWidth + 3) & ~3;
+		m_bBottomUp = nHeight > 0;
+		if (nColorsUsed == 0)
+			nColorsUsed = 256;
+		if (nColorsUsed > 256 || (uint64_t)nHeaderSize + 4 * nColorsUsed > nSize)
+			return false;  // no palette to check
+		for (uint32_t i = 0; i < nColorsUsed; i++)
+		{
+			const unsigned char* c = p + nHeaderSize + 4 * i;
+			if (c[0] != i || c[1] != i || c[2] != i)
+				return false;
+		}
+		return true;
+	}
+	else if (isFourcc(compression, "Y800") || isFourcc(compression, "Y8  ") || isFourcc(compression, "GREY"))
+	{
+		m_nStride = m_nWidth;
+		m_bBottomUp = false;
+		return true;
+	}
+
+	return false;
+}
+
+bool ph::FrameSource::m_checkFrameSize()
+{
+	// the first frame chunk has to hold exactly one frame, padded rows as the format says or unpadded rows from writers
+	// that don't pad them, anything else is left to cv::VideoCapture. the file is left at the start of the frames
+	std::streampos pos = m_file.tellg();
+	uint32_t nSize = 0;
+	bool bFound;
+	while ((bFound = m_findFrameChunk(nSize)) && nSize == 0)
+		;
+	bool bOK = true;
+	if (bFound && nSize != (uint32_t)m_nStride * m_nHeight)
+	{
+		bOK = (nSize == (uint32_t)m_nWidth * m_nHeight);
+		m_nStride = m_nWidth;
+	}
+	m_file.clear();
+	m_file.seekg(pos);
+	return bOK;
+}
+
+bool ph::FrameSource::m_findFrameChunk(uint32_t& nSize)
+{
+	// walk the movi list to the next frame of the video stream, leaving the file at the frame's data
+	char id[4];
+	while (m_readChunkHeader(id, nSize))
+	{
+		if (isFourcc(id, "LIST") || isFourcc(id, "RIFF"))
+		{
+			// rec lists and the AVIX riff chunks of large (OpenDML) files contain more frames, everything else is skipped
+			char type[4];
+			if (nSize < 4 || !m_file.read(type, 4))
+				return false;
+			if (!isFourcc(type, "rec ") && !isFourcc(type, "movi") && !isFourcc(type, "AVIX"))
+				m_skip(nSize - 4);
+			continue;
+		}
+
+		// empty chunks are dropped frames, they are returned too so every chunk counts as a frame
+		if (!m_isFrameChunk(id))
+		{
+			m_skip(nSize);
+			continue;
+		}
+
+		return true;
+	}
+	return false;
+}
+
+bool ph::FrameSource::m_readChunkHeader(char* id, uint32_t& nSize)
+{
+	unsigned char size[4];
+	if (!m_file.read(id, 4) || !m_file.read((char*)size, 4))
+		return false;
+	nSize = getU32(size);
+	return true;
+}
+
+void ph::FrameSource::m_skip(uint32_t nSize)
+{
+	// chunks are padded to an even size
+	m_file.seekg((std::streamoff)nSize + (nSize & 1), std::ios::cur);
+}
+
+bool ph::FrameSource::m_isFrameChunk(const char* id) const
+{
+	// ##db (uncompressed) or ##dc chunks of the video stream
+	return id[0] == '0' + m_nVideoStream / 10 && id[1] == '0' + m_nVideoStream % 10 && id[2] == 'd' && (id[3] == 'b' || id[3] == 'c');
+}
@@ -0,0 +1,60 @@
+#pragma once
+#include <opencv2/core/mat.hpp>
+#include <opencv2/videoio.hpp>
+#include "FrameStack.h"
+#include <cstdint>
+#include <fstream>
+#include <string>
+
+namespace ph
+{
+	class FrameSource
+	{
+		// reads the frames of a video as 8-bit grayscale images
+		// frames of a frame stack are copied out of its mapping
+		// uncompressed 8-bit avi files are read directly into single channel frames, any other format is decoded by cv::VideoCapture
+		// without its rgb conversion and only converted to grayscale if the decoder returns color
+	public:
+		FrameSource() : m_bNative(false), m_nVideoStream(-1), m_nWidth(0), m_nHeight(0), m_nStride(0), m_bBottomUp(false),
+			m_posPrevious(-1), m_nPreviousSize(0), m_bDamaged(false), m_nNextFrame(0), m_dAlignment(0), m_dConvertMs(0) {};
+		FrameSource(const std::string& file) : FrameSource() { open(file); };
+		~FrameSource() { release(); };
+	public:
+		bool open(const std::string& file);
+		bool read(cv::Mat& matFrame);  // returns false at the end of the video, or at a frame that can't be read (see isDamaged)
+		bool skip(int nFrames);  // moves past frames, to resume a run
+		FrameSource& operator>>(cv::Mat& matFrame) { if (!read(matFrame)) matFrame.release(); return *this; };
+		void release();
+		bool isOpened() const { return m_bNative || m_stack.isOpened() || m_cap.isOpened(); };
+		bool isNative() const { return m_bNative; };
+		bool isMapped() const { return m_stack.isOpened(); };
+		bool isAligned() const { return m_stack.isAligned(); };  // frames are already aligned to the first frame
+		bool isDamaged() const { return m_bDamaged; };  // the last read stopped at a short or cut off frame rather than the end of the video
+		double getAlignment() const { return m_dAlignment; };  // correlation coefficient of the last frame's stored alignment
+		double getConvertMs() const { return m_dConvertMs; };  // time the last frame spent in grayscale conversion
+	private:
+		bool m_bNative;  // true when reading an uncompressed avi ourselves
+		cv::VideoCapture m_cap;
+		std::ifstream m_file;
+		int m_nVideoStream;
+		int m_nWidth, m_nHeight;
+		int m_nStride;  // bytes per row in the file
+		bool m_bBottomUp;  // rows stored last to first
+		std::streampos m_posPrevious;  // data of the last frame chunk that wasn't empty, -1 before the first one
+		uint32_t m_nPreviousSize;
+		bool m_bDamaged;
+		FrameStack m_stack;
+		int m_nNextFrame;
+		double m_dAlignment;
+		double m_dConvertMs;
+	private:
+		bool m_openAVI(const std::string& file);
+		bool m_parseFormat(uint32_t nSize);
+		bool m_checkFrameSize();
+		bool m_findFrameChunk(uint32_t& nSize);
+		bool m_readFrameChunk(uint32_t nSize, cv::Mat& matFrame);
+		bool m_readChunkHeader(char* id, uint32_t& nSize);
+		void m_skip(uint32_t nSize);
+		bool m_isFrameChunk(const char* id) const;
+	};
+}
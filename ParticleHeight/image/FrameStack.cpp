@@ -0,0 +1,188 @@
+#include "FrameStack.h"
+#include <cstring>
+#ifdef _WIN32
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace ph;
+
+namespace
+{
+	const uint64_t nPageSize = 4096;  // frames start on page boundaries so reading one only touches its own pages
+	const uint32_t nRowAlignment = 64;
+
+	uint64_t roundUp(uint64_t n, uint64_t m) { return (n + m - 1) / m * m; }
+}
+
+bool ph::FrameStack::open(const std::string& file)
+{
+	close();
+
+	// map the whole file read-only, the frames are only ever copied out of it
+#ifdef _WIN32
+	m_hFile = CreateFileA(file.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (m_hFile == INVALID_HANDLE_VALUE)
+		return false;
+	LARGE_INTEGER nFileSize;
+	GetFileSizeEx(m_hFile, &nFileSize);
+	m_hMapping = CreateFileMappingA(m_hFile, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (!m_hMapping)
+	{
+		CloseHandle(m_hFile);
+		return false;
+	}
+	m_pMapping = (const unsigned char*)MapViewOfFile(m_hMapping, FILE_MAP_READ, 0, 0, 0);
+	if (!m_pMapping)
+	{
+		CloseHandle(m_hMapping);
+		CloseHandle(m_hFile);
+		return false;
+	}
+	m_nMappingSize = (size_t)nFileSize.QuadPart;
+#else
+	int fd = ::open(file.c_str(), O_RDONLY);
+	if (fd < 0)
+		return false;
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size == 0)
+	{
+		::close(fd);
+		return false;
+	}
+	void* p = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	::close(fd);  // the mapping keeps the file open
+	if (p == MAP_FAILED)
+		return false;
+	madvise(p, (size_t)st.st_size, MADV_SEQUENTIAL);  // frames are mostly read in order
+	m_pMapping = (const unsigned char*)p;
+	m_nMappingSize = (size_t)st.st_size;
+#endif
+
+	// check that the header and everything it points to fit in the file
+	m_pHeader = (const FrameStackHeader*)m_pMapping;
+	const FrameStackHeader& h = *m_pHeader;
+	bool bValid = m_nMappingSize >= sizeof(FrameStackHeader)
+		&& std::memcmp(h.magic, "PHFS", 4) == 0
+		&& h.nVersion == nVersion
+		&& h.nStride >= h.nWidth
+		&& h.nFrameBytes >= (uint64_t)h.nStride * h.nHeight
+		&& h.nFrameOffset + h.nFrames * h.nFrameBytes <= m_nMappingSize
+		&& h.nAlignOffset + h.nFrames * sizeof(FrameStackAlignment) <= m_nMappingSize;
+	if (!bValid)
+	{
+		close();
+		return false;
+	}
+
+	return true;
+}
+
+void ph::FrameStack::close()
+{
+	if (!m_pMapping)
+		return;
+
+#ifdef _WIN32
+	UnmapViewOfFile(m_pMapping);
+	CloseHandle(m_hMapping);
+	CloseHandle(m_hFile);
+#else
+	munmap((void*)m_pMapping, m_nMappingSize);
+#endif
+	m_pMapping = nullptr;
+	m_nMappingSize = 0;
+	m_pHeader = nullptr;
+}
+
+void ph::FrameStack::getFrame(int n, cv::Mat& matFrame) const
+{
+	// one copy of the rows without their padding, the view is never handed out since the mapping is read-only
+	const unsigned char* pFrame = m_pMapping + m_pHeader->nFrameOffset + n * m_pHeader->nFrameBytes;
+	cv::Mat(m_pHeader->nHeight, m_pHeader->nWidth, CV_8UC1, (void*)pFrame, m_pHeader->nStride).copyTo(matFrame);
+}
+
+const FrameStackAlignment& ph::FrameStack::getAlignment(int n) const
+{
+	return ((const FrameStackAlignment*)(m_pMapping + m_pHeader->nAlignOffset))[n];
+}
+
+bool ph::FrameStack::isFrameStack(const std::string& file)
+{
+	std::ifstream f(file, std::ios::binary);
+	char magic[4];
+	return f.read(magic, 4) && std::memcmp(magic, "PHFS", 4) == 0;
+}
+
+bool ph::FrameStackWriter::open(const std::string& file, cv::Size sizeFrame, bool bAligned)
+{
+	close();
+	m_file.open(file, std::ios::binary | std::ios::trunc);
+	if (!m_file.is_open())
+		return false;
+
+	std::memset(&m_header, 0, sizeof(m_header));
+	std::memcpy(m_header.magic, "PHFS", 4);
+	m_header.nVersion = FrameStack::nVersion;
+	m_header.nWidth = sizeFrame.width;
+	m_header.nHeight = sizeFrame.height;
+	m_header.nStride = (uint32_t)roundUp(sizeFrame.width, nRowAlignment);
+	m_header.nFlags = bAligned ? FrameStack::FLAG_ALIGNED : 0;
+	m_header.nFrameOffset = nPageSize;
+	m_header.nFrameBytes = roundUp((uint64_t)m_header.nStride * m_header.nHeight, nPageSize);
+	m_vecAlignments.clear();
+	m_vecPadding.assign(nPageSize, 0);
+
+	// the header is written again with the frame count once all of the frames are in
+	m_file.write((const char*)&m_header, sizeof(m_header));
+	m_file.write(m_vecPadding.data(), m_header.nFrameOffset - sizeof(m_header));
+	return (bool)m_file;
+}
+
+bool ph::FrameStackWriter::write(const cv::Mat& matFrame, const cv::Mat& matWarp, double dCorrelation)
+{
+	if (!m_file.is_open() || matFrame.type() != CV_8UC1 || matFrame.cols != (int)m_header.nWidth || matFrame.rows != (int)m_header.nHeight)
+		return false;
+
+	for (int y = 0; y < matFrame.rows; y++)
+	{
+		m_file.write((const char*)matFrame.ptr(y), m_header.nWidth);
+		m_file.write(m_vecPadding.data(), m_header.nStride - m_header.nWidth);
+	}
+	m_file.write(m_vecPadding.data(), m_header.nFrameBytes - (uint64_t)m_header.nStride * m_header.nHeight);
+
+	// identity warp if the frame wasn't aligned
+	FrameStackAlignment alignment = { {1, 0, 0, 0, 1, 0}, (float)dCorrelation, 0 };
+	if (!matWarp.empty())
+	{
+		cv::Mat matWarp32;
+		matWarp.convertTo(matWarp32, CV_32F);
+		for (int i = 0; i < 6; i++)
+			alignment.warp[i] = matWarp32.at<float>(i / 3, i % 3);
+	}
+	m_vecAlignments.push_back(alignment);
+	m_header.nFrames++;
+
+	return (bool)m_file;
+}
+
+bool ph::FrameStackWriter::close()
+{
+	if (!m_file.is_open())
+		return false;
+
+	// the alignment records follow the frames, then the header is completed
+	m_header.nAlignOffset = m_header.nFrameOffset + m_header.nFrames * m_header.nFrameBytes;
+	m_file.write((const char*)m_vecAlignments.data(), m_vecAlignments.size() * sizeof(FrameStackAlignment));
+	m_file.seekp(0);
+	m_file.write((const char*)&m_header, sizeof(m_header));
+	bool bOK = (bool)m_file;
+	m_file.close();
+	return bOK;
+}
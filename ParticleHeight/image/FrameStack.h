@@ -0,0 +1,84 @@
+#pragma once
+#include <opencv2/core/mat.hpp>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+namespace ph
+{
+	// on-disk stack of raw 8-bit frames, decoded (and optionally aligned to the first frame) once so later runs can map it
+	// layout: header, frames at nFrameOffset every nFrameBytes (page aligned), then one alignment record per frame at nAlignOffset
+	struct FrameStackHeader
+	{
+		char magic[4];  // "PHFS"
+		uint32_t nVersion;
+		uint32_t nWidth, nHeight;
+		uint32_t nStride;  // bytes per row
+		uint32_t nFrames;
+		uint32_t nFlags;
+		uint32_t nReserved;
+		uint64_t nFrameOffset;
+		uint64_t nFrameBytes;
+		uint64_t nAlignOffset;
+	};
+
+	// warp found by ImageProcessor::alignToRef and its correlation coefficient
+	struct FrameStackAlignment
+	{
+		float warp[6];  // 2x3 affine, row major
+		float fCorrelation;
+		float fReserved;
+	};
+
+	class FrameStack
+	{
+		// read access to a frame stack through a read-only memory mapping
+		// frames are copied out of the mapping, so the pages stay clean and the os can drop them once a frame is read,
+		// and the caller gets its own buffer to modify
+	public:
+		enum Flags { FLAG_ALIGNED = 1 };  // frames were warped onto frame 0 when the stack was written
+		static const uint32_t nVersion = 1;
+	public:
+		FrameStack() : m_pMapping(nullptr), m_nMappingSize(0), m_pHeader(nullptr) {};
+		~FrameStack() { close(); };
+		FrameStack(const FrameStack&) = delete;
+		FrameStack& operator=(const FrameStack&) = delete;
+	public:
+		bool open(const std::string& file);
+		void close();
+		bool isOpened() const { return m_pHeader != nullptr; };
+		bool isAligned() const { return m_pHeader && (m_pHeader->nFlags & FLAG_ALIGNED); };
+		int getFrameCount() const { return m_pHeader ? (int)m_pHeader->nFrames : 0; };
+		cv::Size getFrameSize() const { return m_pHeader ? cv::Size(m_pHeader->nWidth, m_pHeader->nHeight) : cv::Size(); };
+		void getFrame(int n, cv::Mat& matFrame) const;  // copies frame n into matFrame
+		const FrameStackAlignment& getAlignment(int n) const;
+		static bool isFrameStack(const std::string& file);
+	private:
+		const unsigned char* m_pMapping;
+		size_t m_nMappingSize;
+		const FrameStackHeader* m_pHeader;
+#ifdef _WIN32
+		void* m_hFile;
+		void* m_hMapping;
+#endif
+	};
+
+	class FrameStackWriter
+	{
+		// appends frames to a new frame stack, the header and alignment records are completed by close()
+	public:
+		FrameStackWriter() {};
+		~FrameStackWriter() { close(); };
+	public:
+		bool open(const std::string& file, cv::Size sizeFrame, bool bAligned);
+		bool write(const cv::Mat& matFrame, const cv::Mat& matWarp = cv::Mat(), double dCorrelation = 1.0);
+		bool close();
+		bool isOpened() const { return m_file.is_open(); };
+	private:
+		std::ofstream m_file;
+		FrameStackHeader m_header;
+		std::vector<FrameStackAlignment> m_vecAlignments;
+		std::vector<char> m_vecPadding;  // zeros for the row and frame padding
+	};
+}
@@ -2,20 +2,57 @@
 #include <opencv2/highgui.hpp>  
 #include <iostream>
 #include <queue>
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdint>
 
 using namespace ph;
 
 double ph::ImageProcessor::alignToRef(cv::Mat matParticle) const
+{
+	cv::Mat matWarp;
+	return alignToRef(matParticle, matWarp);
+}
+
+double ph::ImageProcessor::alignToRef(cv::Mat matParticle, cv::Mat& matWarp) const
+{
+	return alignToRef(matParticle, cv::Point(0, 0), matWarp);
+}
+
+double ph::ImageProcessor::alignToRef(cv::Mat matFrame, cv::Point ptRef, cv::Mat& matWarp, int* pIterations) const
 {
 	// matrix to store transformation
-	cv::Mat matWarp = cv::Mat::eye(2, 3, CV_32F);
+	matWarp = cv::Mat::eye(2, 3, CV_32F);
+
+	// find transformation of the region the ref covers
+	const int nMaxIter = 50;
+	const double dEps = 0.001;
+	cv::Mat matRegion = matFrame(cv::Rect(ptRef, m_matRef.size()));
+	double cc;
+	if (!pIterations)
+		cc = cv::findTransformECC(m_matRef, matRegion, matWarp, cv::MOTION_AFFINE,
+			cv::TermCriteria((cv::TermCriteria::COUNT)+(cv::TermCriteria::EPS), nMaxIter, dEps), cv::noArray(), 5 /*gaussFiltSize*/);
+	else
+	{
+		// findTransformECC doesn't report its iterations, so they are run one call at a time with the stopping test of its own loop,
+		// which gives the same warp but repeats the smoothing and gradients of the images in every call
+		double dLast = -dEps;
+		cc = -1;
+		for (*pIterations = 0; *pIterations < nMaxIter && std::fabs(cc - dLast) >= dEps; (*pIterations)++)
+		{
+			dLast = cc;
+			cc = cv::findTransformECC(m_matRef, matRegion, matWarp, cv::MOTION_AFFINE,
+				cv::TermCriteria(cv::TermCriteria::COUNT, 1, 0), cv::noArray(), 5 /*gaussFiltSize*/);
+		}
+	}
 
-	// find transformation
-	double cc = cv::findTransformECC(m_matRef, matParticle, matWarp, cv::MOTION_AFFINE,
-		cv::TermCriteria((cv::TermCriteria::COUNT)+(cv::TermCriteria::EPS), 50, 0.001), cv::noArray(), 5 /*gaussFiltSize*/);
+	// move it to frame coordinates, x' = A (x - p) + t + p, so the whole frame lines up with the region
+	matWarp.at<float>(0, 2) += ptRef.x - matWarp.at<float>(0, 0) * ptRef.x - matWarp.at<float>(0, 1) * ptRef.y;
+	matWarp.at<float>(1, 2) += ptRef.y - matWarp.at<float>(1, 0) * ptRef.x - matWarp.at<float>(1, 1) * ptRef.y;
 
 	// apply transformation to the current frame
-	cv::warpAffine(matParticle, matParticle, matWarp, matParticle.size(), cv::INTER_LINEAR + cv::WARP_INVERSE_MAP);
+	cv::warpAffine(matFrame, matFrame, matWarp, matFrame.size(), cv::INTER_LINEAR + cv::WARP_INVERSE_MAP);
 
 	return cc;
 }
@@ -42,7 +79,8 @@ void ph::ImageProcessor::morphOpen(cv::Mat matParticle) const
 	int nOpenIter = m_pSettings->nOpenIter;
 
 	cv::Mat matKernel = cv::getStructuringElement(cv::MORPH_ELLIPSE, cv::Size(2 * nOpenSize + 1, 2 * nOpenSize + 1), cv::Point(nOpenSize, nOpenSize));
-	cv::morphologyEx(matParticle, matParticle, cv::MORPH_OPEN, matKernel, cv::Point(-1, -1), nOpenIter);
+	m_morphIterate(matParticle, matKernel, nOpenIter, false);
+	m_morphIterate(matParticle, matKernel, nOpenIter, true);
 }
 
 void ph::ImageProcessor::morphClose(cv::Mat matParticle) const
@@ -52,8 +90,75 @@ void ph::ImageProcessor::morphClose(cv::Mat matParticle) const
 	int nCloseIter = m_pSettings->nCloseIter;
 
 	cv::Mat matElement = cv::getStructuringElement(cv::MORPH_ELLIPSE, cv::Size(2 * nCloseSize + 1, 2 * nCloseSize + 1), cv::Point(nCloseSize, nCloseSize));
-	cv::dilate(matParticle, matParticle, matElement /*kernel*/, cv::Point(-1, -1), nCloseIter /*iterations*/);
-	cv::erode(matParticle, matParticle, matElement /*kernel*/, cv::Point(-1, -1), nCloseIter /*iterations*/);
+	m_morphIterate(matParticle, matElement, nCloseIter, true);
+	m_morphIterate(matParticle, matElement, nCloseIter, false);
+}
+
+void ph::ImageProcessor::m_morphIterate(cv::Mat matParticle, cv::Mat matKernel, int nIter, bool bDilate) const
+{
+	// same result as cv::dilate (or cv::erode) with the kernel applied nIter times, in one full frame pass for binary images
+	// a pixel changes in iteration k if it is k kernel steps away from the nearest pixel with the value being spread,
+	// so after the first iteration a breadth first search from the pixels that just changed, stopped after nIter steps,
+	// gives every later iteration while only touching the pixels around the particle edges
+	if (nIter <= 0)
+		return;
+
+	cv::Mat matFirst;
+	if (bDilate)
+		cv::dilate(matParticle, matFirst, matKernel);
+	else
+		cv::erode(matParticle, matFirst, matKernel);
+
+	// the pixels changed by the first iteration, unless the image isn't binary
+	Pixel value = bDilate ? 255 : 0;
+	std::vector<cv::Point> vecFrontier;
+	for (int y = 0; y < matParticle.rows; ++y)
+	{
+		const Pixel* pRow = matParticle.ptr<Pixel>(y);
+		const Pixel* pFirst = matFirst.ptr<Pixel>(y);
+		for (int x = 0; x < matParticle.cols; ++x)
+		{
+			if (pRow[x] != 0 && pRow[x] != 255)
+			{
+				// grayscale images (e.g. without background subtraction in setup mode) are filtered iteratively
+				if (bDilate)
+					cv::dilate(matFirst, matFirst, matKernel, cv::Point(-1, -1), nIter - 1);
+				else
+					cv::erode(matFirst, matFirst, matKernel, cv::Point(-1, -1), nIter - 1);
+				matFirst.copyTo(matParticle);
+				return;
+			}
+			if (pFirst[x] != pRow[x])
+				vecFrontier.emplace_back(x, y);
+		}
+	}
+	for (const cv::Point& p : vecFrontier)
+		matParticle.at<Pixel>(p) = value;
+
+	// a pixel takes its value from the pixels at its kernel offsets, so the value spreads to the pixels at minus those offsets
+	std::vector<cv::Point> vecOffsets;
+	cv::Point anchor(matKernel.cols / 2, matKernel.rows / 2);
+	for (int y = 0; y < matKernel.rows; ++y)
+		for (int x = 0; x < matKernel.cols; ++x)
+			if (matKernel.at<uint8_t>(y, x) != 0)
+				vecOffsets.emplace_back(anchor.x - x, anchor.y - y);
+
+	std::vector<cv::Point> vecNext;
+	for (int k = 1; k < nIter && !vecFrontier.empty(); ++k)
+	{
+		vecNext.clear();
+		for (const cv::Point& p : vecFrontier)
+			for (const cv::Point& offset : vecOffsets)
+			{
+				cv::Point q = p + offset;
+				if (q.x >= 0 && q.y >= 0 && q.x < matParticle.cols && q.y < matParticle.rows && matParticle.at<Pixel>(q) != value)
+				{
+					matParticle.at<Pixel>(q) = value;
+					vecNext.push_back(q);
+				}
+			}
+		std::swap(vecFrontier, vecNext);
+	}
 }
 
 cv::Mat ph::ImageProcessor::morphReconstruct(cv::Mat matMarker, cv::Mat matMask) const
@@ -163,20 +268,7 @@ std::vector<cv::Vec3f> ph::ImageProcessor::findCirclesHough(cv::Mat matParticle)
 
 	// eliminate any circles which contain black pixels as these are not real particles
 	// also eliminate any partial circles at the edges of the image as these won't work with the later height finding
-	float fCircleIntensity = m_pSettings->nCircleIntensity;
-	vecCircles.erase(std::remove_if(vecCircles.begin(), vecCircles.end(),
-		[&](cv::Vec3f c)
-		{
-			if (c[0] < c[2] || c[1] < c[2] || c[0] + c[2] + 1 > m_matRef.cols || c[1] + c[2] + 1 > m_matRef.rows)
-				return true;
-
-			cv::Rect rectRoi = cv::Rect(c[0] - c[2], c[1] - c[2], 2 * c[2] + 1, 2 * c[2] + 1);
-			cv::Mat roi = matParticle(rectRoi);
-			cv::Mat1b mask = cv::Mat::zeros(roi.rows, roi.cols, 0);
-			cv::circle(mask, cv::Point(c[2], c[2]), c[2], cv::Scalar(255, 255, 255), -1);
-			float intensity = cv::mean(roi, mask)[0];
-			return intensity < fCircleIntensity;
-		}), vecCircles.end());
+	m_validateCircles(vecCircles, matParticle);
 
 	return vecCircles;
 }
@@ -188,18 +280,17 @@ std::vector<cv::Vec3f> ph::ImageProcessor::findCirclesEDT(cv::Mat matParticle) c
 	std::vector<cv::Vec3f> vecCircles;
 
 	// pad the image with zeros on all sides and then perform distance transform
-	cv::Mat matParticlePadded, matDist;
+	cv::Mat matParticlePadded, matMaxima;
 	cv::copyMakeBorder(matParticle, matParticlePadded, 1, 1, 1, 1, cv::BORDER_CONSTANT, 0);
-	cv::distanceTransform(matParticlePadded, matDist, cv::DIST_L2, 3 /*mask size*/);
-	cv::normalize(matDist, matDist, 0, 1.0, cv::NORM_MINMAX);  // normalize the values to range 0-1.0
-
-	// perform the h-maxima transform to get rid of shallow minima
-	cv::Mat matHMax = morphReconstruct(cv::max(0, matDist - 0.0001 * m_pSettings->nHMaxParam), matDist);
-
-	// find the regional maxima using the reconstruction operation
-	cv::Mat matMaxima = matHMax - morphReconstruct(cv::max(0, matHMax - 0.001), matHMax);
-	cv::threshold(matMaxima, matMaxima, 0, 255, cv::THRESH_BINARY);
-	matMaxima.convertTo(matMaxima, CV_8U);
+	if (ThreadBudget::isParallelRegion(matParticlePadded.rows * matParticlePadded.cols))
+		matMaxima = m_findMaximaByBlob(matParticlePadded);
+	else
+	{
+		cv::Mat matDist;
+		cv::distanceTransform(matParticlePadded, matDist, cv::DIST_L2, 3 /*mask size*/);
+		cv::normalize(matDist, matDist, 0, 1.0, cv::NORM_MINMAX);  // normalize the values to range 0-1.0
+		matMaxima = m_findMaxima(matDist);
+	}
 
 	// find the centroids of connected components
 	cv::Mat matCentroids, matLabels, matStats;
@@ -214,6 +305,22 @@ std::vector<cv::Vec3f> ph::ImageProcessor::findCirclesEDT(cv::Mat matParticle) c
 	}
 
 	// erase any partial circles at the edges of the image, or ones that are not fully filled in
+	m_validateCircles(vecCircles, matParticle);
+
+	return vecCircles;
+}
+
+void ph::ImageProcessor::m_validateCircles(std::vector<cv::Vec3f>& vecCircles, cv::Mat matParticle) const
+{
+	// erase the circles that reach past the edges of the image or whose mean intensity is below the threshold
+	// each disk is drawn once per radius with cv::circle and kept as the runs of its rows, then summed directly in the image,
+	// which gives the same decisions as drawing a mask for every circle and taking cv::mean over it
+	struct diskRun
+	{
+		int y, xStart, xEnd;  // relative to the corner of the circle's bounding square
+	};
+	std::vector<std::vector<diskRun>> vecDisks;  // indexed by the radius in whole pixels
+
 	float fCircleIntensity = m_pSettings->nCircleIntensity;
 	vecCircles.erase(std::remove_if(vecCircles.begin(), vecCircles.end(),
 		[&](cv::Vec3f c)
@@ -221,13 +328,127 @@ std::vector<cv::Vec3f> ph::ImageProcessor::findCirclesEDT(cv::Mat matParticle) c
 			if (c[0] < c[2] || c[1] < c[2] || c[0] + c[2] + 1 > m_matRef.cols || c[1] + c[2] + 1 > m_matRef.rows)
 				return true;
 
-			cv::Rect rectRoi = cv::Rect(c[0] - c[2], c[1] - c[2], 2 * c[2] + 1, 2 * c[2] + 1);
-			cv::Mat roi = matParticle(rectRoi);
-			cv::Mat1b mask = cv::Mat::zeros(roi.rows, roi.cols, 0);
-			cv::circle(mask, cv::Point(c[2], c[2]), c[2], cv::Scalar(255, 255, 255), -1);
-			float intensity = cv::mean(roi, mask)[0];
+			// the square and the disk are truncated to whole pixels as cv::Rect and cv::circle would
+			int nRadius = (int)c[2];
+			if (nRadius >= (int)vecDisks.size())
+				vecDisks.resize(nRadius + 1);
+			std::vector<diskRun>& vecRuns = vecDisks[nRadius];
+			if (vecRuns.empty())
+			{
+				cv::Mat1b mask = cv::Mat::zeros(2 * nRadius + 1, 2 * nRadius + 1, 0);
+				cv::circle(mask, cv::Point(nRadius, nRadius), nRadius, cv::Scalar(255, 255, 255), -1);
+				for (int y = 0; y < mask.rows; ++y)
+					for (int x = 0; x < mask.cols; ++x)
+						if (mask(y, x) != 0 && (x == 0 || mask(y, x - 1) == 0))
+						{
+							int xEnd = x;
+							while (xEnd < mask.cols && mask(y, xEnd) != 0)
+								++xEnd;
+							vecRuns.push_back({ y, x, xEnd });
+						}
+			}
+
+			int x0 = (int)(c[0] - c[2]);
+			int y0 = (int)(c[1] - c[2]);
+			int64_t nSum = 0, nCount = 0;
+			for (const diskRun& run : vecRuns)
+			{
+				const Pixel* pRow = matParticle.ptr<Pixel>(y0 + run.y) + x0;
+				for (int x = run.xStart; x < run.xEnd; ++x)
+					nSum += pRow[x];
+				nCount += run.xEnd - run.xStart;
+			}
+			float intensity = (float)(nSum * (nCount != 0 ? 1. / nCount : 0.));  // the same arithmetic as cv::mean
 			return intensity < fCircleIntensity;
 		}), vecCircles.end());
+}
 
-	return vecCircles;
+cv::Mat ph::ImageProcessor::m_findMaxima(cv::Mat matDist) const
+{
+	// perform the h-maxima transform to get rid of shallow minima
+	cv::Mat matHMax = morphReconstruct(cv::max(0, matDist - 0.0001 * m_pSettings->nHMaxParam), matDist);
+
+	// find the regional maxima using the reconstruction operation
+	cv::Mat matMaxima = matHMax - morphReconstruct(cv::max(0, matHMax - 0.001), matHMax);
+	cv::threshold(matMaxima, matMaxima, 0, 255, cv::THRESH_BINARY);
+	matMaxima.convertTo(matMaxima, CV_8U);
+	return matMaxima;
+}
+
+cv::Mat ph::ImageProcessor::m_findMaximaByBlob(cv::Mat matParticlePadded) const
+{
+	// same maxima as the full frame path, but each 8-connected blob of foreground is processed on its own and in parallel
+	// the distance transform and both reconstructions never cross the zero pixels around a blob,
+	// so the blob's bounding box with a 1 pixel border is all the halo they need for exact results
+	cv::Mat matLabels, matStats, matCentroids;
+	int nBlobs = cv::connectedComponentsWithStats(matParticlePadded, matLabels, matStats, matCentroids, 8, CV_32S);
+
+	std::vector<cv::Rect> vecRect(nBlobs);
+	std::vector<cv::Mat> vecDist(nBlobs);
+	std::vector<double> vecMax(nBlobs, 0.0);
+	cv::parallel_for_(cv::Range(1, nBlobs), [&](const cv::Range& blobs)
+	{
+		for (int i = blobs.start; i < blobs.end; ++i)
+		{
+			// the padding keeps the border inside the image, other blobs in the box count as background
+			vecRect[i] = cv::Rect(matStats.at<int>(i, cv::CC_STAT_LEFT) - 1, matStats.at<int>(i, cv::CC_STAT_TOP) - 1,
+				matStats.at<int>(i, cv::CC_STAT_WIDTH) + 2, matStats.at<int>(i, cv::CC_STAT_HEIGHT) + 2);
+			cv::distanceTransform(matLabels(vecRect[i]) == i, vecDist[i], cv::DIST_L2, 3 /*mask size*/);
+			cv::minMaxLoc(vecDist[i], nullptr, &vecMax[i]);
+		}
+	});
+
+	// normalize every blob by the largest distance in the frame, with the same scale cv::normalize uses (the minimum is the zero border)
+	double dMax = *std::max_element(vecMax.begin(), vecMax.end());
+	double dScale = (float)(dMax > DBL_EPSILON ? 1.0 / dMax : 0.0);
+
+	// blobs only write their own pixels, so the overlapping boxes don't race
+	cv::Mat matMaxima = cv::Mat::zeros(matParticlePadded.size(), CV_8U);
+	cv::parallel_for_(cv::Range(1, nBlobs), [&](const cv::Range& blobs)
+	{
+		for (int i = blobs.start; i < blobs.end; ++i)
+		{
+			vecDist[i].convertTo(vecDist[i], CV_32F, dScale);
+			matMaxima(vecRect[i]).setTo(255, m_findMaxima(vecDist[i]));
+		}
+	});
+
+	return matMaxima;
+}
+
+float ph::ImageProcessor::correlateRegions(const cv::Mat& matImage, const cv::Mat& matTemplate)
+{
+	// accumulate the sums in integers so the result doesn't depend on the summation order
+	int64_t sumI = 0, sumT = 0, sumII = 0, sumTT = 0, sumIT = 0;
+	for (int y = 0; y < matImage.rows; ++y)
+	{
+		const Pixel* pI = matImage.ptr<Pixel>(y);
+		const Pixel* pT = matTemplate.ptr<Pixel>(y);
+		for (int x = 0; x < matImage.cols; ++x)
+		{
+			int i = pI[x], t = pT[x];
+			sumI += i;
+			sumT += t;
+			sumII += i * i;
+			sumTT += t * t;
+			sumIT += i * t;
+		}
+	}
+
+	double n = (double)matImage.rows * matImage.cols;
+	double num = sumIT - (double)sumI * sumT / n;
+	double varI = std::max(sumII - (double)sumI * sumI / n, 0.0);
+	double varT = std::max(sumTT - (double)sumT * sumT / n, 0.0);
+	double t = std::sqrt(varI * varT);
+
+	// handle a constant template and a vanishing denominator the same way as cv::matchTemplate
+	// a template of failed rays is all zeros
+	if (varT / n < DBL_EPSILON)
+		return 1.0f;
+	if (std::fabs(num) < t)
+		return (float)(num / t);
+	else if (std::fabs(num) < t * 1.125)
+		return num > 0 ? 1.0f : -1.0f;
+	else
+		return 0.0f;
 }
\ No newline at end of file
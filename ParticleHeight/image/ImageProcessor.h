@@ -1,9 +1,11 @@
 #pragma once
 #include <opencv2/core/mat.hpp>
+#include <opencv2/core/utility.hpp>
 #include <opencv2/core/hal/interface.h>
 #include <opencv2/video/tracking.hpp>
 #include <opencv2/video/background_segm.hpp>
 #include "util/Settings.h"
+#include "util/ThreadBudget.h"
 
 namespace ph
 {
@@ -15,9 +17,12 @@ namespace ph
 		~ImageProcessor() {};
 	public:
 		void setRef(cv::Mat matRef) { m_matRef = matRef; };
+		cv::Mat getRef() const { return m_matRef; };
 		void setSettings(const Settings* s) { m_pSettings = s; };
 	public:
 		double alignToRef(cv::Mat matParticle) const;
+		double alignToRef(cv::Mat matParticle, cv::Mat& matWarp) const;
+		double alignToRef(cv::Mat matFrame, cv::Point ptRef, cv::Mat& matWarp, int* pIterations = nullptr) const;  // the ref is the region of matFrame at ptRef
 		void subtractBackground(cv::Mat matParticle) const;
 		void morphOpen(cv::Mat matParticle) const;
 		void morphClose(cv::Mat matParticle) const;
@@ -25,43 +30,74 @@ namespace ph
 		std::vector<cv::Vec3f> findCirclesHough(cv::Mat matParticle) const;
 		std::vector<cv::Vec3f> findCirclesEDT(cv::Mat matParticle) const;  // more robust circle finding
 
+		// normalized correlation coefficient of two 8-bit images of the same size (same as cv::matchTemplate with cv::TM_CCOEFF_NORMED)
+		static float correlateRegions(const cv::Mat& matImage, const cv::Mat& matTemplate);
+
 		// template member functions for use with functors
 		template <class F>
 		cv::Mat transformRef(cv::Rect rectRegion, F transform) const
 		{
 			// return a new Mat which is the region of the ref image specified by rectRegion transformed by the function transform
+			cv::Mat matOutput;
+			transformRef(rectRegion, transform, matOutput);
+			return matOutput;
+		}
+
+		template <class F>
+		void transformRef(cv::Rect rectRegion, const F& transform, cv::Mat& matOutput) const
+		{
+			// fill matOutput with the region of the ref image specified by rectRegion transformed by the function transform
 			// transform should take an x, y coordinate of the transformed image and return by reference where in the ref image to get that pixel value
 			// transform returns true if the transformation is possible and false if not (e.g. if a ray is cast beyond the bounds of the ref image)
+			// matOutput is only reallocated if it doesn't already have the size of the region, pixels that can't be transformed are set to zero
 
-			// create the output matrix and initialize to all zeros
-			cv::Mat matOutput(rectRegion.size(), CV_8UC1, cv::Scalar(0));
+			matOutput.create(rectRegion.size(), CV_8UC1);
 
-			// set each pixel of the output matrix using opencv::mat's forEach (parallelized)
-			matOutput.forEach<Pixel>
-				(
-					[&](Pixel& pixel, const int* position) -> void
+			auto transformRows = [&](const cv::Range& rows) -> void
+			{
+				for (int y = rows.start; y < rows.end; ++y)
+				{
+					Pixel* pRow = matOutput.ptr<Pixel>(y);
+					for (int x = 0; x < matOutput.cols; ++x)
 					{
-						int pxPosY = position[0];  // these are flipped because the Mat object is indexed row, col
-						int pxPosX = position[1];
+						int pxPosX = x;
+						int pxPosY = y;
 						// try transforming that position and make sure the resulting location is within bounds of ref image
 						if (transform(pxPosX, pxPosY) && pxPosX + rectRegion.x >= 0 && pxPosY + rectRegion.y >= 0 && pxPosX + rectRegion.x < m_matRef.cols && pxPosY + rectRegion.y < m_matRef.rows)
-							pixel = m_matRef.at<uint8_t>(pxPosY + rectRegion.y, pxPosX + rectRegion.x);  // at is indexed row, column (y, x)
+							pRow[x] = m_matRef.at<uint8_t>(pxPosY + rectRegion.y, pxPosX + rectRegion.x);  // at is indexed row, column (y, x)
+						else
+							pRow[x] = 0;
 					}
-			);
+				}
+			};
 
-			return matOutput;
+			// small regions like the DIC regions are transformed serially, large ones with opencv's parallel backend if the thread budget allows it
+			if (ThreadBudget::isParallelRegion(rectRegion.area()))
+				cv::parallel_for_(cv::Range(0, matOutput.rows), transformRows);
+			else
+				transformRows(cv::Range(0, matOutput.rows));
 		}
 
 		template <class F>
 		float correlateTransform(F transform, cv::Rect rectRegion, const cv::Mat matParticle) const
 		{
-			cv::Mat matTransIm = transformRef(rectRegion, transform);
+			cv::Mat matTransIm;
+			return correlateTransform(transform, rectRegion, matParticle, matTransIm);
+		}
 
-			cv::Mat matCorrelation;
-			cv::matchTemplate(matParticle(rectRegion), matTransIm, matCorrelation, cv::TM_CCOEFF_NORMED);
-			return matCorrelation.at<float>(0, 0);
+		template <class F>
+		float correlateTransform(const F& transform, cv::Rect rectRegion, const cv::Mat& matParticle, cv::Mat& matTransIm) const
+		{
+			// matTransIm is scratch space for the transformed ref image, reused if it already has the size of the region
+			transformRef(rectRegion, transform, matTransIm);
+			return correlateRegions(matParticle(rectRegion), matTransIm);
 		}
 
+	private:
+		void m_morphIterate(cv::Mat matParticle, cv::Mat matKernel, int nIter, bool bDilate) const;
+		cv::Mat m_findMaxima(cv::Mat matDist) const;
+		void m_validateCircles(std::vector<cv::Vec3f>& vecCircles, cv::Mat matParticle) const;
+		cv::Mat m_findMaximaByBlob(cv::Mat matParticlePadded) const;
 	private:
 		cv::Mat m_matRef;
 		int m_typeRef;  // array type of the reference image
@@ -0,0 +1,176 @@
+#include "MaskFile.h"
+#include <cstring>
+
+using namespace ph;
+
+namespace
+{
+	void appendVarint(std::vector<char>& vecBlock, uint32_t n)
+	{
+		while (n >= 0x80)
+		{
+			vecBlock.push_back((char)(n | 0x80));
+			n >>= 7;
+		}
+		vecBlock.push_back((char)n);
+	}
+
+	bool readVarint(const unsigned char*& p, const unsigned char* pEnd, uint32_t& n)
+	{
+		n = 0;
+		for (int nShift = 0; p < pEnd && nShift < 32; nShift += 7)
+		{
+			n |= (uint32_t)(*p & 0x7F) << nShift;
+			if (!(*p++ & 0x80))
+				return true;
+		}
+		return false;
+	}
+}
+
+bool ph::MaskWriter::open(const std::string& file, cv::Size size)
+{
+	close();
+	if (!m_writer.open(file))
+		return false;
+
+	MaskFileHeader header = { {'P', 'H', 'M', 'K'}, nVersion, (uint32_t)size.width, (uint32_t)size.height };
+	m_writer.write(&header, sizeof(header));
+	m_vecIndex.clear();
+	return true;
+}
+
+bool ph::MaskWriter::resume(const std::string& file, cv::Size size, uint64_t nOffset, const std::vector<MaskFrameIndex>& vecIndex)
+{
+	// continue a file from a sync, dropping the blocks written after it and the index if the file was closed
+	close();
+	{
+		MaskFileHeader header;
+		std::ifstream inFile(file, std::ios::binary);
+		if (!inFile.read((char*)&header, sizeof(header)) || std::memcmp(header.magic, "PHMK", 4) != 0 || header.nVersion != nVersion
+			|| header.nWidth != (uint32_t)size.width || header.nHeight != (uint32_t)size.height)
+			return false;
+	}
+	if (nOffset < sizeof(MaskFileHeader) || !m_writer.resume(file, nOffset))
+		return false;
+
+	m_vecIndex = vecIndex;
+	return true;
+}
+
+uint32_t ph::MaskWriter::encode(const cv::Mat& matMask, std::vector<char>& vecBlock)
+{
+	// run lengths in raster order, continuing across the rows
+	vecBlock.clear();
+	size_t nPixels = matMask.total();
+	size_t nPackedBytes = (nPixels + 7) / 8;
+	bool bParticle = false;
+	uint32_t nRun = 0;
+	for (int i = 0; i < matMask.rows && vecBlock.size() < nPackedBytes; i++)
+	{
+		const uchar* pRow = matMask.ptr<uchar>(i);
+		for (int j = 0; j < matMask.cols; j++)
+		{
+			if ((pRow[j] != 0) != bParticle)
+			{
+				appendVarint(vecBlock, nRun);
+				bParticle = !bParticle;
+				nRun = 0;
+			}
+			nRun++;
+		}
+	}
+	if (vecBlock.size() < nPackedBytes)
+	{
+		appendVarint(vecBlock, nRun);
+		if (vecBlock.size() <= nPackedBytes)
+			return ENCODING_RUNS;
+	}
+
+	// too many runs, a noisy mask is smaller bit-packed
+	vecBlock.assign(nPackedBytes, 0);
+	size_t k = 0;
+	for (int i = 0; i < matMask.rows; i++)
+	{
+		const uchar* pRow = matMask.ptr<uchar>(i);
+		for (int j = 0; j < matMask.cols; j++, k++)
+			if (pRow[j] != 0)
+				vecBlock[k >> 3] |= (char)(1 << (k & 7));
+	}
+	return ENCODING_BITS;
+}
+
+void ph::MaskWriter::write(int nFrame, uint32_t nEncoding, std::vector<char>&& vecBlock)
+{
+	m_vecIndex.push_back({ (uint32_t)nFrame, nEncoding, m_writer.getOffset(), vecBlock.size() });
+	m_writer.write(std::move(vecBlock));
+}
+
+bool ph::MaskWriter::close()
+{
+	if (!m_writer.isOpened())
+		return false;
+
+	// append the index and the trailer after the blocks
+	MaskFileTrailer trailer = { m_writer.getOffset(), m_vecIndex.size(), {'P', 'H', 'M', 'I'}, 0 };
+	m_writer.write(m_vecIndex.data(), m_vecIndex.size() * sizeof(MaskFrameIndex));
+	m_writer.write(&trailer, sizeof(trailer));
+	return m_writer.close();
+}
+
+bool ph::MaskReader::open(const std::string& file)
+{
+	m_file.open(file, std::ios::binary);
+	if (!m_file.is_open())
+		return false;
+
+	// check the header, then find the index through the trailer
+	MaskFileHeader header;
+	MaskFileTrailer trailer;
+	if (!m_file.read((char*)&header, sizeof(header)) || std::memcmp(header.magic, "PHMK", 4) != 0 || header.nVersion != MaskWriter::nVersion)
+		return false;
+	m_size = cv::Size(header.nWidth, header.nHeight);
+	m_file.seekg(-(std::streamoff)sizeof(trailer), std::ios::end);
+	if (!m_file.read((char*)&trailer, sizeof(trailer)) || std::memcmp(trailer.magic, "PHMI", 4) != 0)
+		return false;
+
+	m_vecIndex.resize(trailer.nFrames);
+	m_file.seekg(trailer.nIndexOffset);
+	return (bool)m_file.read((char*)m_vecIndex.data(), m_vecIndex.size() * sizeof(MaskFrameIndex));
+}
+
+bool ph::MaskReader::readFrame(size_t i, cv::Mat& matMask)
+{
+	m_vecBlock.resize(m_vecIndex[i].nBytes);
+	m_file.seekg(m_vecIndex[i].nOffset);
+	if (!m_file.read(m_vecBlock.data(), m_vecBlock.size()))
+		return false;
+
+	matMask.create(m_size, CV_8UC1);
+	uchar* pPixels = matMask.ptr<uchar>(0);  // created continuous
+	size_t nPixels = matMask.total();
+	const unsigned char* p = (const unsigned char*)m_vecBlock.data();
+	const unsigned char* pEnd = p + m_vecBlock.size();
+	if (m_vecIndex[i].nEncoding == MaskWriter::ENCODING_BITS)
+	{
+		if (m_vecBlock.size() < (nPixels + 7) / 8)
+			return false;
+		for (size_t k = 0; k < nPixels; k++)
+			pPixels[k] = (p[k >> 3] >> (k & 7)) & 1 ? 255 : 0;
+		return true;
+	}
+
+	// fill the alternating runs
+	size_t k = 0;
+	uchar value = 0;
+	while (p < pEnd)
+	{
+		uint32_t nRun;
+		if (!readVarint(p, pEnd, nRun) || nRun > nPixels - k)
+			return false;
+		std::memset(pPixels + k, value, nRun);
+		k += nRun;
+		value = ~value;
+	}
+	return k == nPixels;
+}
@@ -0,0 +1,85 @@
+#pragma once
+#include <opencv2/core/mat.hpp>
+#include "util/BlockWriter.h"
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+namespace ph
+{
+	// lossless binary particle masks (.phm)
+	// layout: header, one encoded block per frame, the frame index, then the trailer which locates the index from the end of the file
+	// a block holds the frame's pixels in raster order, either as alternating background and particle run lengths (LEB128 varints,
+	// starting with background) or bit-packed eight pixels per byte, whichever is smaller
+	struct MaskFileHeader
+	{
+		char magic[4];  // "PHMK"
+		uint32_t nVersion;
+		uint32_t nWidth, nHeight;
+	};
+
+	struct MaskFrameIndex
+	{
+		uint32_t nFrame;
+		uint32_t nEncoding;  // one of MaskWriter::Encoding
+		uint64_t nOffset;  // start of the frame's block
+		uint64_t nBytes;
+	};
+
+	struct MaskFileTrailer
+	{
+		uint64_t nIndexOffset;
+		uint64_t nFrames;
+		char magic[4];  // "PHMI"
+		uint32_t nReserved;
+	};
+
+	class MaskWriter
+	{
+		// frames are encoded by the caller, which can be done in parallel, and written in order by a background thread in large buffered writes
+		// the index is appended by close(), sync() makes everything written so far durable so a run can be resumed with resume()
+	public:
+		static const uint32_t nVersion = 1;
+		enum Encoding
+		{
+			ENCODING_RUNS = 0,
+			ENCODING_BITS = 1
+		};
+	public:
+		MaskWriter() {};
+		~MaskWriter() { close(); };
+	public:
+		bool open(const std::string& file, cv::Size size);
+		bool resume(const std::string& file, cv::Size size, uint64_t nOffset, const std::vector<MaskFrameIndex>& vecIndex);
+		static uint32_t encode(const cv::Mat& matMask, std::vector<char>& vecBlock);  // any nonzero pixel is a particle, returns the Encoding
+		void write(int nFrame, uint32_t nEncoding, std::vector<char>&& vecBlock);
+		bool sync() { return m_writer.sync(); };
+		bool close();
+		bool isOpened() const { return m_writer.isOpened(); };
+		uint64_t getOffset() const { return m_writer.getOffset(); };
+		const std::vector<MaskFrameIndex>& getIndex() const { return m_vecIndex; };
+	private:
+		BlockWriter m_writer;
+		std::vector<MaskFrameIndex> m_vecIndex;
+	};
+
+	class MaskReader
+	{
+		// random access to the frames of a mask file through its index
+	public:
+		MaskReader() {};
+		~MaskReader() {};
+	public:
+		bool open(const std::string& file);
+		size_t getFrameCount() const { return m_vecIndex.size(); };
+		const MaskFrameIndex& getFrameIndex(size_t i) const { return m_vecIndex[i]; };
+		cv::Size getSize() const { return m_size; };
+		bool readFrame(size_t i, cv::Mat& matMask);  // 8-bit, 255 for particles
+	private:
+		std::ifstream m_file;
+		cv::Size m_size;
+		std::vector<MaskFrameIndex> m_vecIndex;
+		std::vector<char> m_vecBlock;
+	};
+}
@@ -0,0 +1,104 @@
+#include "Checkpoint.h"
+#include "util/FileIO.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+
+using namespace ph;
+
+namespace
+{
+	void writeString(std::ostream& os, const std::string& s)
+	{
+		ph::writeValue(os, (uint64_t)s.size());
+		os.write(s.data(), s.size());
+	}
+
+	bool readString(std::istream& is, std::string& s)
+	{
+		uint64_t nSize;
+		if (!ph::readValue(is, nSize))
+			return false;
+		s.resize((size_t)nSize);
+		return nSize == 0 || (bool)is.read(&s[0], s.size());
+	}
+}
+
+bool ph::Checkpoint::save(const std::string& file) const
+{
+	std::string sTemp = file + ".tmp";
+	{
+		std::ofstream outFile(sTemp, std::ios::binary | std::ios::trunc);
+		if (!outFile.is_open())
+			return false;
+
+		outFile.write("PHCP", 4);
+		writeValue(outFile, (uint32_t)nVersion);
+		writeValue(outFile, (int32_t)nFirstFrame);
+		writeValue(outFile, (int32_t)nLastFrame);
+		writeValue(outFile, (int32_t)nStride);
+		for (int i = 0; i < 4; i++)
+			writeValue(outFile, (int32_t)nROI[i]);
+		writeValue(outFile, nSettingsHash);
+		writeValue(outFile, (int32_t)nFrames);
+		writeValue(outFile, (uint8_t)bComplete);
+		writeValue(outFile, nCSVOffset);
+		writeValue(outFile, nResultsOffset);
+		writeValue(outFile, nMaskOffset);
+		writeValue(outFile, nMetricsOffset);
+		writeVector(outFile, vecResultIndex);
+		writeVector(outFile, vecMaskIndex);
+		writeVector(outFile, vecPrevious);
+		writeVector(outFile, vecPreviousKnown);
+		writeString(outFile, sLinker);
+		writeString(outFile, sStatistics);
+		outFile.flush();
+		if (!outFile)
+			return false;
+	}
+
+	// renaming over the old checkpoint is atomic except on windows, which needs it removed first
+	if (std::rename(sTemp.c_str(), file.c_str()) == 0)
+		return true;
+	std::remove(file.c_str());
+	return std::rename(sTemp.c_str(), file.c_str()) == 0;
+}
+
+bool ph::Checkpoint::load(const std::string& file)
+{
+	std::ifstream inFile(file, std::ios::binary);
+	if (!inFile.is_open())
+		return false;
+
+	char magic[4];
+	uint32_t nFileVersion;
+	int32_t nSelection[3], nFileROI[4], nFileFrames;
+	uint8_t nComplete;
+	if (!inFile.read(magic, 4) || std::memcmp(magic, "PHCP", 4) != 0 || !readValue(inFile, nFileVersion) || nFileVersion != nVersion)
+		return false;
+	for (int i = 0; i < 3; i++)
+		if (!readValue(inFile, nSelection[i]))
+			return false;
+	for (int i = 0; i < 4; i++)
+		if (!readValue(inFile, nFileROI[i]))
+			return false;
+	if (!readValue(inFile, nSettingsHash) || !readValue(inFile, nFileFrames) || !readValue(inFile, nComplete) || !readValue(inFile, nCSVOffset) || !readValue(inFile, nResultsOffset)
+		|| !readValue(inFile, nMaskOffset) || !readValue(inFile, nMetricsOffset) || !readVector(inFile, vecResultIndex) || !readVector(inFile, vecMaskIndex)
+		|| !readVector(inFile, vecPrevious) || !readVector(inFile, vecPreviousKnown) || !readString(inFile, sLinker) || !readString(inFile, sStatistics))
+		return false;
+	nFirstFrame = nSelection[0];
+	nLastFrame = nSelection[1];
+	nStride = nSelection[2];
+	for (int i = 0; i < 4; i++)
+		nROI[i] = nFileROI[i];
+	nFrames = nFileFrames;
+	bComplete = (nComplete != 0);
+	return vecPrevious.size() == vecPreviousKnown.size();
+}
+
+bool ph::Checkpoint::isSameRun(const Checkpoint& cp) const
+{
+	return nFirstFrame == cp.nFirstFrame && nLastFrame == cp.nLastFrame && nStride == cp.nStride && std::equal(nROI, nROI + 4, cp.nROI)
+		&& nSettingsHash == cp.nSettingsHash;
+}
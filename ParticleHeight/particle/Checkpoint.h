@@ -0,0 +1,38 @@
+#pragma once
+#include "ResultFile.h"
+#include "image/MaskFile.h"
+#include "util/vf3.h"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace ph
+{
+	// the state of a video run after its last written frame, saved every few frames so an interrupted run can be resumed
+	// the outputs are synced before it is saved and each offset is where that output ends, anything written later is dropped on resume
+	// the alignment needs no state since every frame is aligned to the ref image on its own
+	// the frame selection, region of interest and settings of the run are kept so a resumed run can check it does the same work
+	struct Checkpoint
+	{
+		static const uint32_t nVersion = 2;
+
+		Checkpoint() : nFirstFrame(0), nLastFrame(0), nStride(0), nROI{ 0, 0, 0, 0 }, nSettingsHash(0), nFrames(0), bComplete(false),
+			nCSVOffset(-1), nResultsOffset(-1), nMaskOffset(-1), nMetricsOffset(-1) {};
+		bool save(const std::string& file) const;  // written to a temporary file first so an interruption keeps the previous checkpoint
+		bool load(const std::string& file);
+		bool isSameRun(const Checkpoint& cp) const;  // same frame selection, region of interest and settings
+
+		int nFirstFrame, nLastFrame, nStride;  // frames selected by -f and -k
+		int nROI[4];  // x, y, width and height of the region of interest in pixels
+		uint64_t nSettingsHash;  // Settings::getHash
+		int nFrames;  // frames written after the ref image
+		bool bComplete;  // the whole video was processed and its outputs closed
+		int64_t nCSVOffset, nResultsOffset, nMaskOffset, nMetricsOffset;  // -1 if the output isn't written
+		std::vector<ResultFrameIndex> vecResultIndex;
+		std::vector<MaskFrameIndex> vecMaskIndex;
+		std::vector<vf3> vecPrevious;  // particles of the last frame, which can seed the heights of the next one
+		std::vector<char> vecPreviousKnown;
+		std::string sLinker;  // saved by TrajectoryLinker, empty if the trajectories aren't linked
+		std::string sStatistics;  // saved by FlowStatistics, empty if they aren't written
+	};
+}
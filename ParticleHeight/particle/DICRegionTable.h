@@ -0,0 +1,55 @@
+#pragma once
+
+namespace ph
+{
+	// square root usable in constant expressions (Newton iteration in double precision)
+	constexpr double constSqrt(double x)
+	{
+		if (x <= 0)
+			return 0;
+
+		double r = x > 1 ? x : 1;
+		for (int i = 0; i < 64; ++i)
+		{
+			double next = 0.5 * (r + x / r);
+			if (next == r)
+				break;
+			r = next;
+		}
+		return r;
+	}
+
+	template <int N>
+	struct DICRegionTable
+	{
+		// polar coordinates of every pixel of an N x N DIC region about its center pixel
+		// pixel (x, y) is stored at index y * N + x, the direction is the unit vector from the center to the pixel
+		constexpr DICRegionTable() : radius(), dirX(), dirY()
+		{
+			for (int y = 0; y < N; ++y)
+				for (int x = 0; x < N; ++x)
+				{
+					double dx = x - (N >> 1);
+					double dy = y - (N >> 1);
+					double r = constSqrt(dx * dx + dy * dy);
+					radius[y * N + x] = (float)r;
+					dirX[y * N + x] = (r == 0) ? 0.0f : (float)(dx / r);
+					dirY[y * N + x] = (r == 0) ? 0.0f : (float)(dy / r);
+				}
+		}
+
+		float radius[N * N];
+		float dirX[N * N];
+		float dirY[N * N];
+	};
+
+	template <int N>
+	struct DICRegion
+	{
+		// one table per region size, generated at compile time
+		static constexpr DICRegionTable<N> table = DICRegionTable<N>();
+	};
+
+	template <int N>
+	constexpr DICRegionTable<N> DICRegion<N>::table;
+}
@@ -0,0 +1,85 @@
+#include "EvalWorkspace.h"
+
+using namespace ph;
+
+ph::EvalWorkspace::EvalWorkspace(const Settings* s) : m_pSettings(s)
+{
+	m_pPattern = std::make_shared<OpticalPattern>(vf3(0, 0, 0), vf3(0, 0, 1));
+	m_pLayer = std::make_shared<OpticalLayer>();
+}
+
+OpticalScene& ph::EvalWorkspace::buildScene(const std::vector<Particle*>& vecpParticles)
+{
+	// the particles come first in the scene, followed by the pattern, and then the optical layer
+	// the group objective relies on this order to move the spheres
+	m_beginScene();
+	for (size_t i = 0; i < vecpParticles.size(); ++i)
+		m_addSphere(i, vecpParticles[i]);
+	m_endScene();
+
+	return m_scene;
+}
+
+OpticalScene& ph::EvalWorkspace::buildScene(const Particle* pParticle)
+{
+	// scene with the particle and its immediate neighbors
+	m_beginScene();
+	m_addSphere(0, pParticle);
+	size_t i = 1;
+	for (auto n : pParticle->getNeighbors())
+		m_addSphere(i++, n);
+	m_endScene();
+
+	return m_scene;
+}
+
+std::vector<Particle>& ph::EvalWorkspace::getParticles(size_t n)
+{
+	// the returned vector holds at least n particles, only the first n should be used
+	if (m_vecParticles.size() < n)
+		m_vecParticles.resize(n);
+
+	return m_vecParticles;
+}
+
+std::vector<double>& ph::EvalWorkspace::getCorrelations(size_t n)
+{
+	if (m_vecCorrelations.size() < n)
+		m_vecCorrelations.resize(n);
+
+	return m_vecCorrelations;
+}
+
+std::vector<double>& ph::EvalWorkspace::getBestCorrelations(size_t n)
+{
+	if (m_vecBestCorrelations.size() < n)
+		m_vecBestCorrelations.resize(n);
+
+	return m_vecBestCorrelations;
+}
+
+void ph::EvalWorkspace::m_beginScene()
+{
+	// the optical parameters may have changed since the last scene (e.g. during calibration)
+	m_scene.clearMedia();
+	m_scene.setRefractionIndex(m_pSettings->fEtaLiquid);
+}
+
+void ph::EvalWorkspace::m_addSphere(size_t i, const Particle* pParticle)
+{
+	// update a sphere from the pool in place, only allocating if the pool is too small
+	OpticalSphere sphere(pParticle->getPositionReal(), pParticle->getRadiusReal(), m_pSettings->fEtaParticle);
+	if (i < m_vecpSpheres.size())
+		*m_vecpSpheres[i] = sphere;
+	else
+		m_vecpSpheres.push_back(std::make_shared<OpticalSphere>(sphere));
+
+	m_scene.addMedium(m_vecpSpheres[i]);
+}
+
+void ph::EvalWorkspace::m_endScene()
+{
+	*m_pLayer = OpticalLayer(vf3(0, 0, 0), vf3(0, 0, m_pSettings->fChannelWallThickness), vf3(0, 0, 1), m_pSettings->fEtaGlass);
+	m_scene.addMedium(m_pPattern);  // pattern
+	m_scene.addMedium(m_pLayer);  // bottom channel wall
+}
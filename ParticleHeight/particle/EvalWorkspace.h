@@ -0,0 +1,45 @@
+#pragma once
+#include <opencv2/core/mat.hpp>
+#include <vector>
+#include <memory>
+#include "Particle.h"
+#include "ray/OpticalScene.h"
+#include "ray/OpticalLayer.h"
+#include "ray/OpticalPattern.h"
+#include "ray/OpticalSphere.h"
+#include "util/Settings.h"
+
+namespace ph
+{
+	class EvalWorkspace
+	{
+		// scratch space for evaluating the correlation objectives, reused between evaluations so the optimizer loop doesn't allocate
+		// each thread evaluating objectives needs its own workspace
+	public:
+		EvalWorkspace(const Settings* s);
+		EvalWorkspace() : EvalWorkspace(nullptr) {};
+		~EvalWorkspace() {};
+	public:
+		void setSettings(const Settings* s) { m_pSettings = s; };
+		OpticalScene& buildScene(const std::vector<Particle*>& vecpParticles);
+		OpticalScene& buildScene(const Particle* pParticle);
+		std::vector<Particle>& getParticles(size_t n);
+		std::vector<double>& getCorrelations(size_t n);
+		std::vector<double>& getBestCorrelations(size_t n);
+		cv::Mat& getTransformed() { return m_matTransformed; };
+	private:
+		void m_beginScene();
+		void m_addSphere(size_t i, const Particle* pParticle);
+		void m_endScene();
+	private:
+		const Settings* m_pSettings;
+		OpticalScene m_scene;
+		std::vector<std::shared_ptr<OpticalSphere>> m_vecpSpheres;  // grows to the largest group seen
+		std::shared_ptr<OpticalPattern> m_pPattern;
+		std::shared_ptr<OpticalLayer> m_pLayer;
+		std::vector<Particle> m_vecParticles;
+		std::vector<double> m_vecCorrelations;  // per particle correlations of the current evaluation
+		std::vector<double> m_vecBestCorrelations;  // per particle correlations of the best evaluation so far
+		cv::Mat m_matTransformed;
+	};
+}
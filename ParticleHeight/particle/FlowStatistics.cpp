@@ -0,0 +1,171 @@
+#include "FlowStatistics.h"
+#include <opencv2/imgproc.hpp>
+#include <fstream>
+#include "util/FileIO.h"
+
+using namespace ph;
+
+static float getAxis(const vf3& v, int nAxis)
+{
+	return (nAxis == 0) ? v.x : ((nAxis == 1) ? v.y : v.z);
+}
+
+ph::FlowStatistics::FlowStatistics(const Settings* pSettings, cv::Size imageSize, cv::Rect rectMask) : m_pSettings(pSettings), m_imageSize(imageSize),
+	m_rectMask(rectMask), m_fBinSize(pSettings->fStatisticsBinSize)
+{
+	if (m_rectMask.area() <= 0)
+		m_rectMask = cv::Rect(0, 0, imageSize.width, imageSize.height);
+
+	// the image spans x and z, the channel spans y
+	m_nBins[0] = std::max(1, (int)ceil(imageSize.height / pSettings->fPxPerMM / m_fBinSize));
+	m_nBins[1] = std::max(1, (int)ceil(pSettings->fChannelHeight / m_fBinSize));
+	m_nBins[2] = std::max(1, (int)ceil(imageSize.width / pSettings->fPxPerMM / m_fBinSize));
+
+	m_vecMaskX.resize(m_rectMask.height);
+	m_vecMaskZ.resize(m_rectMask.width);
+	for (int a = 0; a < 3; a++)
+	{
+		m_vecCount[a].resize(m_nBins[a]);
+		for (int c = 0; c < 3; c++)
+			m_vecVelocity[a][c].resize(m_nBins[a]);
+	}
+}
+
+void ph::FlowStatistics::reduceMask(const cv::Mat& matMask, cv::Mat& matRows, cv::Mat& matCols)
+{
+	cv::Mat matBinary;
+	cv::threshold(matMask, matBinary, 0, 1, cv::THRESH_BINARY);
+	cv::reduce(matBinary, matRows, 1, cv::REDUCE_SUM, CV_32S);
+	cv::reduce(matBinary, matCols, 0, cv::REDUCE_SUM, CV_32S);
+}
+
+void ph::FlowStatistics::addMask(const cv::Mat& matRows, const cv::Mat& matCols)
+{
+	for (int i = 0; i < m_rectMask.height; i++)
+		m_vecMaskX[i].add(matRows.at<int>(i, 0) / (double)m_rectMask.width);
+	for (int j = 0; j < m_rectMask.width; j++)
+		m_vecMaskZ[j].add(matCols.at<int>(0, j) / (double)m_rectMask.height);
+}
+
+void ph::FlowStatistics::addParticles(const std::vector<vf3>& vecPositions, const std::vector<int>& vecIds)
+{
+	// count the particles of the frame in each bin
+	for (int a = 0; a < 3; a++)
+	{
+		std::vector<int> vecCount(m_nBins[a], 0);
+		for (auto& v : vecPositions)
+		{
+			int nBin = m_getBin(getAxis(v, a), a);
+			if (nBin >= 0)
+				vecCount[nBin]++;
+		}
+		for (int b = 0; b < m_nBins[a]; b++)
+			m_vecCount[a][b].add(vecCount[b]);
+	}
+
+	// particles linked to the previous frame give a velocity at the midpoint of their displacement
+	std::unordered_map<int, vf3> mapCurrent;
+	for (size_t i = 0; i < vecPositions.size(); i++)
+	{
+		mapCurrent[vecIds[i]] = vecPositions[i];
+		auto it = m_mapPrevious.find(vecIds[i]);
+		if (it == m_mapPrevious.end())
+			continue;
+
+		vf3 v = vecPositions[i] - it->second;
+		vf3 mid = (vecPositions[i] + it->second) * 0.5f;
+		for (int a = 0; a < 3; a++)
+		{
+			int nBin = m_getBin(getAxis(mid, a), a);
+			if (nBin < 0)
+				continue;
+			for (int c = 0; c < 3; c++)
+				m_vecVelocity[a][c][nBin].add(getAxis(v, c));
+		}
+	}
+	m_mapPrevious = std::move(mapCurrent);
+}
+
+bool ph::FlowStatistics::write(const std::string& sFile) const
+{
+	std::ofstream file(sFile);
+	if (!file.is_open())
+		return false;
+
+	// profile names are the quantity followed by the axis it is binned along, positions are the bin centers in mm
+	const char* axes[3] = { "x", "y", "z" };
+	file << "profile,position,mean,std,samples\n";
+	for (size_t i = 0; i < m_vecMaskX.size(); i++)
+		file << "area_fraction_x," << (m_rectMask.y + i + 0.5f) / m_pSettings->fPxPerMM << "," << m_vecMaskX[i].dMean << "," << m_vecMaskX[i].getStd() << "," << m_vecMaskX[i].n << "\n";
+	for (size_t j = 0; j < m_vecMaskZ.size(); j++)
+		file << "area_fraction_z," << (m_rectMask.x + j + 0.5f) / m_pSettings->fPxPerMM << "," << m_vecMaskZ[j].dMean << "," << m_vecMaskZ[j].getStd() << "," << m_vecMaskZ[j].n << "\n";
+	for (int a = 0; a < 3; a++)
+		for (int b = 0; b < m_nBins[a]; b++)
+			file << "particles_" << axes[a] << "," << (b + 0.5f) * m_fBinSize << "," << m_vecCount[a][b].dMean << "," << m_vecCount[a][b].getStd() << "," << m_vecCount[a][b].n << "\n";
+	for (int c = 0; c < 3; c++)
+		for (int a = 0; a < 3; a++)
+			for (int b = 0; b < m_nBins[a]; b++)
+			{
+				const RunningStatistic& s = m_vecVelocity[a][c][b];
+				file << "velocity_" << axes[c] << "_" << axes[a] << "," << (b + 0.5f) * m_fBinSize << "," << s.dMean << "," << s.getStd() << "," << s.n << "\n";
+			}
+
+	return file.good();
+}
+
+void ph::FlowStatistics::save(std::ostream& os) const
+{
+	writeVector(os, m_vecMaskX);
+	writeVector(os, m_vecMaskZ);
+	for (int a = 0; a < 3; a++)
+		writeVector(os, m_vecCount[a]);
+	for (int a = 0; a < 3; a++)
+		for (int c = 0; c < 3; c++)
+			writeVector(os, m_vecVelocity[a][c]);
+
+	// trajectories of the previous frame, for the next velocities
+	std::vector<int> vecIds;
+	std::vector<vf3> vecPositions;
+	for (auto& p : m_mapPrevious)
+	{
+		vecIds.push_back(p.first);
+		vecPositions.push_back(p.second);
+	}
+	writeVector(os, vecIds);
+	writeVector(os, vecPositions);
+}
+
+bool ph::FlowStatistics::load(std::istream& is)
+{
+	// every profile has to keep its size
+	auto readProfile = [&](std::vector<RunningStatistic>& vec)
+	{
+		size_t nSize = vec.size();
+		return readVector(is, vec) && vec.size() == nSize;
+	};
+	if (!readProfile(m_vecMaskX) || !readProfile(m_vecMaskZ))
+		return false;
+	for (int a = 0; a < 3; a++)
+		if (!readProfile(m_vecCount[a]))
+			return false;
+	for (int a = 0; a < 3; a++)
+		for (int c = 0; c < 3; c++)
+			if (!readProfile(m_vecVelocity[a][c]))
+				return false;
+
+	std::vector<int> vecIds;
+	std::vector<vf3> vecPositions;
+	if (!readVector(is, vecIds) || !readVector(is, vecPositions) || vecIds.size() != vecPositions.size())
+		return false;
+	m_mapPrevious.clear();
+	for (size_t i = 0; i < vecIds.size(); i++)
+		m_mapPrevious[vecIds[i]] = vecPositions[i];
+	return true;
+}
+
+int ph::FlowStatistics::m_getBin(float f, int nAxis) const
+{
+	// -1 outside the image or the channel
+	int nBin = (int)floor(f / m_fBinSize);
+	return (nBin >= 0 && nBin < m_nBins[nAxis]) ? nBin : -1;
+}
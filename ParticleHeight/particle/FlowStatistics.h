@@ -0,0 +1,55 @@
+#pragma once
+#include <opencv2/core.hpp>
+#include <math.h>
+#include <istream>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "util/Settings.h"
+#include "util/vf3.h"
+
+namespace ph
+{
+	// mean and standard deviation accumulated one sample at a time (Welford's method)
+	struct RunningStatistic
+	{
+		RunningStatistic() : n(0), dMean(0), dM2(0) {};
+		void add(double x) { n++; double d = x - dMean; dMean += d / n; dM2 += d * (x - dMean); };
+		double getStd() const { return (n > 1) ? sqrt(dM2 / (n - 1)) : 0.0; };
+
+		size_t n;
+		double dMean, dM2;
+	};
+
+	class FlowStatistics
+	{
+		// concentration profiles and velocity statistics accumulated frame by frame while a video is processed, instead of
+		// analysing the debug video afterwards. the masks give the particle area fraction along the paper's x and z axes (image
+		// rows and columns), the solved positions give the number of particles per frame in bins along all three axes, and the
+		// linked trajectories give velocity profiles (mm per frame) along all three axes
+		// the masks can cover a region of the image, the particle positions always span the whole image
+	public:
+		FlowStatistics(const Settings* pSettings, cv::Size imageSize, cv::Rect rectMask = cv::Rect());  // an empty rectMask is the whole image
+		~FlowStatistics() {};
+	public:
+		static void reduceMask(const cv::Mat& matMask, cv::Mat& matRows, cv::Mat& matCols);  // foreground pixels of each row and column, safe to call in parallel
+		void addMask(const cv::Mat& matRows, const cv::Mat& matCols);
+		void addParticles(const std::vector<vf3>& vecPositions, const std::vector<int>& vecIds);  // paper coordinates, frames in order
+		bool write(const std::string& sFile) const;  // csv of profile, position, mean, std, samples
+		void save(std::ostream& os) const;  // the accumulated statistics, for checkpoints
+		bool load(std::istream& is);  // fails if the bins don't match the settings and image size
+	private:
+		const Settings* m_pSettings;
+		cv::Size m_imageSize;
+		cv::Rect m_rectMask;
+		float m_fBinSize;
+		int m_nBins[3];  // position bins along each paper axis
+		std::vector<RunningStatistic> m_vecMaskX, m_vecMaskZ;  // area fraction of each row and column of the mask region
+		std::vector<RunningStatistic> m_vecCount[3];  // particles per frame in each bin
+		std::vector<RunningStatistic> m_vecVelocity[3][3];  // velocity component [c] in the bins along axis [a]
+		std::unordered_map<int, vf3> m_mapPrevious;  // positions of the previous frame by trajectory id
+	private:
+		int m_getBin(float f, int nAxis) const;
+	};
+}
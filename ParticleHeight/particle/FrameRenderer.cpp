@@ -0,0 +1,56 @@
+#include "FrameRenderer.h"
+#include <algorithm>
+#include <math.h>
+#include <memory>
+#include "ray/OpticalLayer.h"
+#include "ray/OpticalPattern.h"
+#include "ray/OpticalScene.h"
+#include "ray/OpticalSphere.h"
+
+using namespace ph;
+
+void ph::FrameRenderer::render(const std::vector<vf3>& vecPositions, cv::Mat& matFrame) const
+{
+	m_matRef.copyTo(matFrame);
+	float fPxPerMM = m_pSettings->fPxPerMM;
+	float fRadius = m_pSettings->fParticleRadiusPx / fPxPerMM;
+
+	for (size_t i = 0; i < vecPositions.size(); i++)
+	{
+		// the scene of each particle holds the particles whose outlines overlap it, which are all of the particles any of its pixels can see
+		const vf3& c = vecPositions[i];
+		OpticalScene scene(m_pSettings->fEtaLiquid);
+		scene.addMedium(std::make_shared<OpticalPattern>(vf3(0, 0, 0), vf3(0, 0, 1)));  // pattern
+		scene.addMedium(std::make_shared<OpticalLayer>(vf3(0, 0, 0), vf3(0, 0, m_pSettings->fChannelWallThickness), vf3(0, 0, 1), m_pSettings->fEtaGlass));  // bottom channel wall
+		auto pSphere = std::make_shared<OpticalSphere>(c, fRadius, m_pSettings->fEtaParticle);
+		scene.addMedium(pSphere);  // particle
+		for (size_t j = 0; j < vecPositions.size(); j++)
+		{
+			const vf3& n = vecPositions[j];
+			if (j != i && (n.x - c.x) * (n.x - c.x) + (n.y - c.y) * (n.y - c.y) < 4 * fRadius * fRadius)
+				scene.addMedium(std::make_shared<OpticalSphere>(n, fRadius, m_pSettings->fEtaParticle));  // add each neighbor
+		}
+
+		// trace the pixels inside its outline
+		int nMinX = std::max(0, (int)floor((c.x - fRadius) * fPxPerMM)), nMaxX = std::min(matFrame.cols - 1, (int)ceil((c.x + fRadius) * fPxPerMM));
+		int nMinY = std::max(0, (int)floor((c.y - fRadius) * fPxPerMM)), nMaxY = std::min(matFrame.rows - 1, (int)ceil((c.y + fRadius) * fPxPerMM));
+		for (int y = nMinY; y <= nMaxY; y++)
+		{
+			uint8_t* pRow = matFrame.ptr<uint8_t>(y);
+			for (int x = nMinX; x <= nMaxX; x++)
+			{
+				float fPosX = x / fPxPerMM, fPosY = y / fPxPerMM;
+				if (!pSphere->overlapsPoint(fPosX, fPosY))
+					continue;
+
+				Ray r(vf3(fPosX, fPosY, 5), vf3(0, 0, -1));
+				vf3 t = scene.getRayTermination(r);
+				int nRefX = (int)(t.x * fPxPerMM), nRefY = (int)(t.y * fPxPerMM);
+				if (fabs(t.z) < 1e-4f && nRefX >= 0 && nRefY >= 0 && nRefX < m_matRef.cols && nRefY < m_matRef.rows)
+					pRow[x] = m_matRef.at<uint8_t>(nRefY, nRefX);
+				else
+					pRow[x] = 0;
+			}
+		}
+	}
+}
@@ -0,0 +1,23 @@
+#pragma once
+#include <opencv2/core/mat.hpp>
+#include <vector>
+#include "util/Settings.h"
+#include "util/vf3.h"
+
+namespace ph
+{
+	class FrameRenderer
+	{
+		// renders synthetic particle frames over the ref image by tracing a ray from each pixel covered by a particle through the
+		// particles and the channel wall to the pattern, like TransformMultiple does for overlapping groups. pixels outside the
+		// particles show the ref image and rays that never reach the pattern (total internal reflection at the rims) are dark
+	public:
+		FrameRenderer(const cv::Mat& matRef, const Settings* pSettings) : m_matRef(matRef), m_pSettings(pSettings) {};
+		~FrameRenderer() {};
+	public:
+		void render(const std::vector<vf3>& vecPositions, cv::Mat& matFrame) const;  // particle centers in channel coordinates (mm)
+	private:
+		cv::Mat m_matRef;
+		const Settings* m_pSettings;
+	};
+}
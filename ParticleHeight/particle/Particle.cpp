@@ -4,7 +4,7 @@ using namespace ph;
 
 const Settings* Particle::m_pSettings = nullptr;
 
-ph::Particle::Particle(float radius, float pxPosX, float pxPosY, float unused) : m_pxCircleRadius(radius), m_bHeightKnown(false), m_fConfidence(0)
+ph::Particle::Particle(float radius, float pxPosX, float pxPosY, float unused) : m_pxCircleRadius(radius), m_bHeightKnown(false), m_fConfidence(0), m_nGroup(-1), m_nEvals(0)
 {
 	setPosition(pxPosX, pxPosY);
 }
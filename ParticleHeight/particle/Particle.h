@@ -11,7 +11,7 @@ namespace ph
 		Particle(float radius, float pxPosX, float pxPosY, float unused);
 		Particle() : m_pxCircleRadius(m_pSettings->fParticleRadiusPx), m_pxCirclePosX(0), m_pxCirclePosY(0), 
 			m_vPosition(vf3(0, 0, m_pSettings->fChannelWallThickness + 0.5 * m_pSettings->fChannelHeight)), 
-			m_bHeightKnown(false), m_fConfidence(0), m_nSizeCorrelation(m_pSettings->nDICRegionSize) {};
+			m_bHeightKnown(false), m_fConfidence(0), m_nSizeCorrelation(m_pSettings->nDICRegionSize), m_nGroup(-1), m_nEvals(0) {};
 		~Particle() {};
 	public:
 		bool isOverlapping(const Particle&) const;
@@ -19,6 +19,7 @@ namespace ph
 		void setHeightKnown(bool h) { m_bHeightKnown = h; };
 		void setPosition(vf3 newPosition) { m_vPosition = newPosition; m_pxCirclePosX = realToPx(newPosition.x); m_pxCirclePosY = realToPx(newPosition.y); };
 		void setPosition(float pxPosX, float pxPosY) { m_pxCirclePosX = pxPosX; m_pxCirclePosY = pxPosY; m_vPosition.x = pxToReal(pxPosX); m_vPosition.y = pxToReal(pxPosY); };
+		void setHeight(float z) { m_vPosition.z = z; };
 		vf3 getPositionReal() const { return m_vPosition; };
 		void getPositionPx(float& pxPosX, float& pxPosY) const { pxPosX = m_pxCirclePosX; pxPosY = m_pxCirclePosY; };
 		float getRadiusPx() const { return m_pxCircleRadius; };
@@ -27,6 +28,10 @@ namespace ph
 		float getConfidence() const { return m_fConfidence; };
 		void setSizeCorrelation(int s) { m_nSizeCorrelation = s; };
 		int getSizeCorrelation() const { return m_nSizeCorrelation; };
+		void setGroup(int g) { m_nGroup = g; };
+		int getGroup() const { return m_nGroup; };
+		void setEvals(unsigned n) { m_nEvals = n; };
+		unsigned getEvals() const { return m_nEvals; };
 		bool hasNeighbors() const { return !m_vecNeighbors.empty(); };
 		void addNeighbor(Particle* p) { m_vecNeighbors.push_back(p); };
 		std::vector<Particle*> getNeighbors() const { return m_vecNeighbors; };
@@ -39,6 +44,8 @@ namespace ph
 		bool m_bHeightKnown;
 		float m_fConfidence;
 		int m_nSizeCorrelation;
+		int m_nGroup;  // index of the overlapping group the particle was solved with in its frame, -1 before solving
+		unsigned m_nEvals;  // objective evaluations used to find the height, shared by the whole group
 		std::vector<Particle*> m_vecNeighbors;  // particles immediately connected to this one
 	private:
 		static const Settings* m_pSettings;
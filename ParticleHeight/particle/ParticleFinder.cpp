@@ -3,38 +3,64 @@
 #include <list>
 #include <iostream>
 #include <chrono>
+#include <algorithm>
+#include <set>
 
 using namespace ph;
 
-std::list<Particle> ph::ParticleFinder::findParticles(cv::Mat matParticle, bool bUseHough)
+std::list<Particle> ph::ParticleFinder::findParticles(cv::Mat matParticle, bool bUseHough, const std::list<Particle>* pPrevious, FrameMetrics* pMetrics)
 {
 	// matParticle should already be aligned to the reference pattern image
+	// pPrevious optionally holds the particles found in the previous frame, used to seed the group heights (see Settings::nGroupInitMode)
 	if (m_bVerbose) std::cout << "finding particles...";
 
+	return solveParticles(matParticle, detectParticles(matParticle, bUseHough, pMetrics), pPrevious, pMetrics);
+}
+
+std::vector<cv::Vec3f> ph::ParticleFinder::detectParticles(cv::Mat matParticle, bool bUseHough, FrameMetrics* pMetrics) const
+{
+	// find the circles of the particles in the image plane, this only depends on the image processing settings
+	// and not on the optical parameters so the result can be reused while those change
+
 	// Preprocess a copy of the image
 	cv::Mat matParticleCopy = matParticle.clone();
-	m_pRefProcessor->subtractBackground(matParticleCopy);
-	m_pRefProcessor->morphClose(matParticleCopy);
-	m_pRefProcessor->morphOpen(matParticleCopy);
+	{
+		StageTimer timer(pMetrics, FrameMetrics::STAGE_BACKGROUND);
+		m_pRefProcessor->subtractBackground(matParticleCopy);
+	}
+	{
+		StageTimer timer(pMetrics, FrameMetrics::STAGE_MORPHOLOGY);
+		m_pRefProcessor->morphClose(matParticleCopy);
+		m_pRefProcessor->morphOpen(matParticleCopy);
+	}
 	
 	// Use Hough transform or EDT to initially find circles
+	StageTimer timer(pMetrics, FrameMetrics::STAGE_CIRCLES);
 	std::vector<cv::Vec3f> vecCircles;
 	if (bUseHough)
 		vecCircles = m_pRefProcessor->findCirclesHough(matParticleCopy);
 	else
 		vecCircles = m_pRefProcessor->findCirclesEDT(matParticleCopy);
 
-	// The preprocessed image is no longer needed - release it
-	matParticleCopy.release();
+	return vecCircles;
+}
+
+std::list<Particle> ph::ParticleFinder::solveParticles(cv::Mat matParticle, const std::vector<cv::Vec3f>& vecCircles, const std::list<Particle>* pPrevious, FrameMetrics* pMetrics)
+{
+	// find the 3d positions of the particles from their circles detected in matParticle
+	StageTimer timer(pMetrics, FrameMetrics::STAGE_HEIGHTS);
 
 	// begin timing particle finding
 	auto startTime = std::chrono::high_resolution_clock::now();
 
-	// create a list of particles from the vector of circles
+	// create a list of particles from the vector of circles, starting at mid height in the channel described by our settings
 	std::list<Particle> listParticles(vecCircles.size());
 	int i = 0;
 	for (auto it = listParticles.begin(); it != listParticles.end(); ++it, ++i)
+	{
 		it->setPosition(vecCircles[i][0], vecCircles[i][1]);
+		it->setHeight(m_pSettings->fChannelWallThickness + 0.5f * m_pSettings->fChannelHeight);
+	}
 
 	// update each particle's neighbors
 	for (auto p1 = listParticles.begin(); p1 != listParticles.end(); ++p1)
@@ -45,79 +71,165 @@ std::list<Particle> ph::ParticleFinder::findParticles(cv::Mat matParticle, bool
 				p2->addNeighbor(&(*p1));
 			}
 
-	// find height of every overlapping group of particles (including single particles)
-	int nSingleParticles = 0, nGroups = 0;
-	unsigned nTotalSingleEvals = 0, nTotalGroupEvals = 0, nEvals;
+	// collect every overlapping group of particles (including single particles) whose height needs to be found
+	std::vector<std::vector<Particle*>> vecGroups;
+	std::set<const Particle*> setGrouped;
 	for (auto& p : listParticles)
-		if (!p.isHeightKnown())
-			if (p.hasNeighbors())
-			{
-				// find the height of the overlapping particle group
-				nGroups++;
-				std::vector<Particle*> vecpGroup;
-				p.getOverlapGroup(vecpGroup);
-				double dConfidence;
-				if (m_findHeightGroup(vecpGroup, matParticle, dConfidence, nEvals))
-				{
-					nTotalGroupEvals += nEvals;
-					for (auto p : vecpGroup)
-					{
-						p->setHeightKnown(true);
-
-						// update the confidence for this particle by constructing a scene with its nearest neighbors
-						OpticalScene scene(m_pSettings->fEtaLiquid);
-						scene.addMedium(std::make_shared<OpticalPattern>(vf3(0, 0, 0), vf3(0, 0, 1)));  // pattern
-						scene.addMedium(std::make_shared<OpticalLayer>(vf3(0, 0, 0), vf3(0, 0, m_pSettings->fChannelWallThickness), vf3(0, 0, 1), m_pSettings->fEtaGlass));  // bottom channel wall
-						scene.addMedium(std::make_shared<OpticalSphere>(p->getPositionReal(), p->getRadiusReal(), m_pSettings->fEtaParticle));  // add the particle
-						for (auto n : p->getNeighbors())
-							scene.addMedium(std::make_shared<OpticalSphere>(n->getPositionReal(), n->getRadiusReal(), m_pSettings->fEtaParticle));  // add each neighbor
-
-						float posX, posY;
-						p->getPositionPx(posX, posY);
-						cv::Rect rectRegion((int)posX - (m_pSettings->nDICRegionSize >> 1), (int)posY - (m_pSettings->nDICRegionSize >> 1), m_pSettings->nDICRegionSize, m_pSettings->nDICRegionSize);
-						p->setConfidence((float)(m_pRefProcessor->correlateTransform(TransformMultiple(p, m_pSettings, &scene), rectRegion, matParticle)));
-					}
-				}
-			}
-			else
+		if (!p.isHeightKnown() && setGrouped.find(&p) == setGrouped.end())
+		{
+			std::vector<Particle*> vecpGroup;
+			p.getOverlapGroup(vecpGroup);
+			setGrouped.insert(vecpGroup.begin(), vecpGroup.end());
+			vecGroups.push_back(vecpGroup);
+		}
+
+	// find the heights of the groups, these are independent so they can run as parallel tasks
+	std::vector<heightResult> vecResults(vecGroups.size());
+	auto solveGroup = [&](size_t i)
+	{
+		TraceScope trace(vecGroups[i].size() > 1 ? "group" : "particle", pMetrics ? pMetrics->nFrame : -1, (int)vecGroups[i].size());
+		uint64_t nRays = OpticalScene::getRaysTraced();
+		vecResults[i] = m_findHeights(vecGroups[i], matParticle, pPrevious);
+		vecResults[i].nRays = OpticalScene::getRaysTraced() - nRays;
+	};
+	if (m_pScheduler != nullptr)
+	{
+		TaskGroup tasks;
+		for (size_t i = 0; i < vecGroups.size(); ++i)
+			m_pScheduler->submit(tasks, [&solveGroup, i]() { solveGroup(i); }, m_estimateCost(vecGroups[i].size()));
+		m_pScheduler->wait(tasks);
+	}
+	else
+		for (size_t i = 0; i < vecGroups.size(); ++i)
+			solveGroup(i);
+
+	// label the particles with their group and tally the evaluations
+	int nSingleParticles = 0, nGroups = 0;
+	unsigned nTotalSingleEvals = 0, nTotalGroupEvals = 0, nTotalInitEvals = 0;
+	for (size_t i = 0; i < vecGroups.size(); ++i)
+	{
+		for (auto p : vecGroups[i])
+		{
+			p->setGroup((int)i);
+			p->setEvals(vecResults[i].nEvals + vecResults[i].nInitEvals);
+		}
+
+		if (vecGroups[i].size() == 1)
+		{
+			nSingleParticles++;
+			if (vecResults[i].bFound)
+				nTotalSingleEvals += vecResults[i].nEvals;
+		}
+		else
+		{
+			nGroups++;
+			if (vecResults[i].bFound)
 			{
-				// find the height of the single particle
-				nSingleParticles++;
-				double dConfidence;
-				if (m_findHeightSingle(&p, matParticle, dConfidence, nEvals))
-				{
-					nTotalSingleEvals += nEvals;
-					p.setHeightKnown(true);
-					p.setConfidence((float)dConfidence);
-				}
+				nTotalGroupEvals += vecResults[i].nEvals;
+				nTotalInitEvals += vecResults[i].nInitEvals;
 			}
+		}
+	}
 
 	auto endTime = std::chrono::high_resolution_clock::now();
 
+	if (pMetrics)
+	{
+		pMetrics->nParticles = (int)listParticles.size();
+		pMetrics->nGroups = nGroups;
+		for (auto& r : vecResults)
+		{
+			pMetrics->nEvals += r.nEvals + r.nInitEvals;
+			pMetrics->nRays += r.nRays;
+		}
+	}
+
 	// print results
 	if (m_bVerbose)
 		std::cout << "\rfound " << listParticles.size() << " particles (" << nSingleParticles
 			<< " individual with avg. " << ((nSingleParticles == 0) ? 0 : nTotalSingleEvals/nSingleParticles) 
 			<< " evals, " << nGroups << " groups with avg. " << ((nGroups == 0) ? 0 : nTotalGroupEvals/nGroups) 
-			<< " evals) in " << std::chrono::duration_cast<std::chrono::milliseconds>(endTime - startTime).count()
+			<< " evals + " << ((nGroups == 0) ? 0 : nTotalInitEvals/nGroups) << " for the initial guess) in " << std::chrono::duration_cast<std::chrono::milliseconds>(endTime - startTime).count()
 			<< " ms" << std::endl;
 
 	return listParticles;
 }
 
-bool ph::ParticleFinder::m_findHeightSingle(Particle* pParticle, cv::Mat matParticle, double& dConfidence, unsigned& nEvals)
+ParticleFinder::heightResult ph::ParticleFinder::m_findHeights(std::vector<Particle*>& vecpGroup, cv::Mat matParticle, const std::list<Particle>* pPrevious) const
+{
+	// find the height of a single particle or an overlapping group of particles
+	heightResult result{ false, 0, 0, 0 };
+	double dConfidence;
+	if (vecpGroup.size() == 1)
+	{
+		Particle* p = vecpGroup[0];
+		if (m_findHeightSingle(p, matParticle, dConfidence, result.nEvals))
+		{
+			result.bFound = true;
+			p->setHeightKnown(true);
+			p->setConfidence((float)dConfidence);
+		}
+	}
+	else if (m_findHeightGroup(vecpGroup, matParticle, dConfidence, result.nEvals, result.nInitEvals, pPrevious))
+	{
+		result.bFound = true;
+		for (auto p : vecpGroup)
+		{
+			p->setHeightKnown(true);
+
+			// the optimizer already set the confidence, optionally recompute it using a scene with only the nearest neighbors
+			if (m_pSettings->bRecomputeConfidence)
+			{
+				EvalWorkspace& workspace = m_getWorkspace();
+				OpticalScene& scene = workspace.buildScene(p);
+
+				float posX, posY;
+				p->getPositionPx(posX, posY);
+				cv::Rect rectRegion((int)posX - (m_pSettings->nDICRegionSize >> 1), (int)posY - (m_pSettings->nDICRegionSize >> 1), m_pSettings->nDICRegionSize, m_pSettings->nDICRegionSize);
+				p->setConfidence((float)(m_pRefProcessor->correlateTransform(TransformMultiple(p, m_pSettings, &scene), rectRegion, matParticle, workspace.getTransformed())));
+			}
+		}
+	}
+
+	return result;
+}
+
+float ph::ParticleFinder::m_estimateCost(size_t nGroupSize) const
 {
+	// rough relative cost of finding the heights of a group, used to schedule the expensive groups first
+	// the pixels correlated per evaluation times the expected number of evaluations: single particles use the analytical
+	// transform and converge quickly, groups are ray traced and need more evaluations for every particle added
+	float fPixels = (float)m_pSettings->nDICRegionSize * m_pSettings->nDICRegionSize * nGroupSize;
+	if (nGroupSize == 1)
+		return fPixels * 30;
+	else
+		return fPixels * 10 * 100 * nGroupSize;
+}
+
+EvalWorkspace& ph::ParticleFinder::m_getWorkspace() const
+{
+	// every thread evaluating objectives uses its own workspace
+	static thread_local EvalWorkspace workspace;
+	workspace.setSettings(m_pSettings);
+	return workspace;
+}
+
+bool ph::ParticleFinder::m_findHeightSingle(Particle* pParticle, cv::Mat matParticle, double& dConfidence, unsigned& nEvals, unsigned nMaxEvals) const
+{
+	// nMaxEvals caps the number of objective evaluations if it is nonzero
 	
 	bool bFoundParticleHeight = false;
 	
 	// create data object to give to objective function, doesn't have a scene since analytical model used here
-	dataCorrelate data{ m_pRefProcessor, m_pSettings, &matParticle, nullptr, 0 };
+	dataCorrelate data{ m_pRefProcessor, m_pSettings, &matParticle, nullptr, 0, &m_getWorkspace(), -INFINITY };
 
 	nlopt::opt optimizer(nlopt::algorithm::LN_NELDERMEAD, 3);
 	optimizer.set_max_objective(correlateSingleParticle, &data);
 	std::vector<double> vecInitialStep(3, m_pSettings->fInitStepSingle);
 	optimizer.set_initial_step(vecInitialStep);
 	optimizer.set_xtol_abs(m_pSettings->fXtolAbsSingle);
+	if (nMaxEvals > 0)
+		optimizer.set_maxeval(nMaxEvals);
 	std::vector<double> position = { pParticle->getPositionReal().x, pParticle->getPositionReal().y, pParticle->getPositionReal().z };
 
 	try
@@ -135,27 +247,33 @@ bool ph::ParticleFinder::m_findHeightSingle(Particle* pParticle, cv::Mat matPart
 	return bFoundParticleHeight;
 }
 
-bool ph::ParticleFinder::m_findHeightGroup(std::vector<Particle*> vecpParticle, cv::Mat matParticle, double& dConfidence, unsigned& nEvals)
+bool ph::ParticleFinder::m_findHeightGroup(std::vector<Particle*> vecpParticle, cv::Mat matParticle, double& dConfidence, unsigned& nEvals, unsigned& nInitEvals, const std::list<Particle>* pPrevious) const
 {
 	
 	bool bFoundParticleHeights = false;
 
-	// for an initial guess, run the single particle height finding routine on each particle
-	double dTemp;
-	unsigned nTemp;
+	// get an initial guess for each particle, nInitEvals counts the evaluations this takes
+	nInitEvals = 0;
 	for (auto p : vecpParticle)
-		m_findHeightSingle(p, matParticle, dTemp, nTemp);
+	{
+		if (m_pSettings->nGroupInitMode == Settings::GROUP_INIT_PREVIOUS_FRAME && m_seedFromPrevious(p, pPrevious))
+			continue;
+
+		// run the single particle height finding routine, capping the evaluations unless the full solve is requested
+		double dTemp;
+		unsigned nTemp = 0;
+		unsigned nMaxEvals = (m_pSettings->nGroupInitMode == Settings::GROUP_INIT_SINGLE) ? 0 : m_pSettings->nGroupInitMaxEvals;
+		m_findHeightSingle(p, matParticle, dTemp, nTemp, nMaxEvals);
+		nInitEvals += nTemp;
+	}
 
-	// create the optical scene representing this group of particles
-	// add the particles first, followed by the pattern, and then the optical layer
-	OpticalScene scene(m_pSettings->fEtaLiquid);
-	for (auto p : vecpParticle)
-		scene.addMedium(std::make_shared<OpticalSphere>(p->getPositionReal(), p->getRadiusReal(), m_pSettings->fEtaParticle));  // add each particle
-	scene.addMedium(std::make_shared<OpticalPattern>(vf3(0, 0, 0), vf3(0, 0, 1)));  // pattern
-	scene.addMedium(std::make_shared<OpticalLayer>(vf3(0, 0, 0), vf3(0, 0, m_pSettings->fChannelWallThickness), vf3(0, 0, 1), m_pSettings->fEtaGlass));  // bottom channel wall
+	// build the optical scene representing this group of particles
+	// the particles come first, followed by the pattern, and then the optical layer
+	EvalWorkspace& workspace = m_getWorkspace();
+	OpticalScene& scene = workspace.buildScene(vecpParticle);
 	
 	// data structure for passing objective function state to optimizer
-	dataCorrelate data{ m_pRefProcessor, m_pSettings, &matParticle, &scene, 0 };
+	dataCorrelate data{ m_pRefProcessor, m_pSettings, &matParticle, &scene, 0, &workspace, -INFINITY };
 
 	// set up NLopt optimizer object
 	nlopt::opt optimizer(nlopt::algorithm::LN_NELDERMEAD, 3 * vecpParticle.size());
@@ -180,9 +298,13 @@ bool ph::ParticleFinder::m_findHeightGroup(std::vector<Particle*> vecpParticle,
 		dConfidence /= vecpParticle.size();
 		nEvals = data.nEvals;
 
-		// update particle positions
+		// update particle positions, the confidence of each is its correlation at the optimum found
+		std::vector<double>& vecCorrelations = workspace.getBestCorrelations(vecpParticle.size());
 		for (size_t i = 0; i < vecpParticle.size(); ++i)
+		{
 			vecpParticle[i]->setPosition(vf3(position[3 * i + 0], position[3 * i + 1], position[3 * i + 2]));
+			vecpParticle[i]->setConfidence((float)vecCorrelations[i]);
+		}
 
 		bFoundParticleHeights = true;
 	}
@@ -194,24 +316,55 @@ bool ph::ParticleFinder::m_findHeightGroup(std::vector<Particle*> vecpParticle,
 	return bFoundParticleHeights;
 }
 
-double ph::correlateSingleParticle(unsigned n, const double* pos, double* grad, void* data)
+bool ph::ParticleFinder::m_seedFromPrevious(Particle* pParticle, const std::list<Particle>* pPrevious) const
 {
-	// create a temporary particle from the given position array
-	Particle p;
-	p.setPosition(vf3(pos[0], pos[1], pos[2]));
-	float posX, posY;
-	p.getPositionPx(posX, posY);
+	// take the height of the nearest particle in the previous frame if it is within one particle radius in the image plane
+	if (pPrevious == nullptr)
+		return false;
+
+	const Particle* pNearest = nullptr;
+	float fMinDist = pParticle->getRadiusReal();
+	for (auto& p : *pPrevious)
+	{
+		if (!p.isHeightKnown())
+			continue;
 
+		vf3 d = p.getPositionReal() - pParticle->getPositionReal();
+		float dist = sqrtf(d.x * d.x + d.y * d.y);
+		if (dist < fMinDist)
+		{
+			pNearest = &p;
+			fMinDist = dist;
+		}
+	}
+
+	if (pNearest == nullptr)
+		return false;
+
+	vf3 position = pParticle->getPositionReal();
+	pParticle->setPosition(vf3(position.x, position.y, pNearest->getPositionReal().z));
+	return true;
+}
+
+double ph::correlateSingleParticle(unsigned n, const double* pos, double* grad, void* data)
+{
 	// extract data from the correlation data object
 	dataCorrelate* d = (dataCorrelate*)data;
 	const ImageProcessor* processor = d->refProcessor;
 	const Settings* settings = d->settings;
-	cv::Mat im = *(d->matParticle);
+	const cv::Mat& im = *(d->matParticle);
+	cv::Mat& matTransformed = d->workspace->getTransformed();
 	d->nEvals++; // increment the number of function evaluations
 
+	// update the workspace particle from the given position array
+	Particle& p = d->workspace->getParticles(1)[0];
+	p.setPosition(vf3(pos[0], pos[1], pos[2]));
+	float posX, posY;
+	p.getPositionPx(posX, posY);
+
 	// perform the correlation
 	cv::Rect rectRegion((int)posX - (settings->nDICRegionSize >> 1), (int)posY - (settings->nDICRegionSize >> 1), settings->nDICRegionSize, settings->nDICRegionSize);
-	double correlation = processor->correlateTransform(TransformSingle(&p, settings), rectRegion, im);
+	double correlation = applyTransformSingle(&p, settings, [&](const auto& t) { return processor->correlateTransform(t, rectRegion, im, matTransformed); });
 
 	// penalize overlap with the channel walls
 	if (p.getPositionReal().z < settings->fChannelWallThickness + p.getRadiusReal())
@@ -230,14 +383,16 @@ double ph::correlateGroupParticle(unsigned n, const double* pos, double* grad, v
 	dataCorrelate* d = (dataCorrelate*)data;
 	const ImageProcessor* processor = d->refProcessor;
 	const Settings* settings = d->settings;
-	cv::Mat im = *(d->matParticle);
+	const cv::Mat& im = *(d->matParticle);
+	cv::Mat& matTransformed = d->workspace->getTransformed();
 	OpticalScene* scene = d->scene;
 	d->nEvals++; // increment the number of function evaluations
 
-	// create vector of particles from the given position array and update the optical scene
+	// update the workspace particles from the given position array and move the spheres in the optical scene
 	n /= 3;
-	std::vector<Particle> vecP(n);
-	std::vector<std::shared_ptr<OpticalMedium>> media = scene->getMedia();
+	std::vector<Particle>& vecP = d->workspace->getParticles(n);
+	std::vector<double>& vecCorrelations = d->workspace->getCorrelations(n);
+	std::vector<std::shared_ptr<OpticalMedium>>& media = scene->getMedia();
 	for (unsigned i = 0; i < n; ++i)
 	{
 		vecP[i].setPosition(vf3(pos[3 * i + 0], pos[3 * i + 1], pos[3 * i + 2]));
@@ -247,12 +402,14 @@ double ph::correlateGroupParticle(unsigned n, const double* pos, double* grad, v
 
 	// accumulate the correlation for each particle in the scene
 	double correlation = 0;
-	for (auto p = vecP.begin(); p != vecP.end(); ++p)
+	for (unsigned i = 0; i < n; ++i)
 	{
+		const Particle* p = &vecP[i];
 		float posX, posY;
 		p->getPositionPx(posX, posY);
 		cv::Rect rectRegion((int)posX - (settings->nDICRegionSize >> 1), (int)posY - (settings->nDICRegionSize >> 1), settings->nDICRegionSize, settings->nDICRegionSize);
-		correlation += processor->correlateTransform(TransformMultiple(&(*p), settings, scene), rectRegion, im);
+		vecCorrelations[i] = processor->correlateTransform(TransformMultiple(p, settings, scene), rectRegion, im, matTransformed);
+		correlation += vecCorrelations[i];
 
 		// quadratic penalty for overlap between particles or with the walls
 		if (p->getPositionReal().z < settings->fChannelWallThickness + p->getRadiusReal())
@@ -261,14 +418,22 @@ double ph::correlateGroupParticle(unsigned n, const double* pos, double* grad, v
 		if (p->getPositionReal().z > settings->fChannelWallThickness + settings->fChannelHeight - p->getRadiusReal())
 			correlation -= 0.01 * settings->nOverlapPenalty * ((double)p->getPositionReal().z - settings->fChannelWallThickness - settings->fChannelHeight + p->getRadiusReal())
 								     * ((double)p->getPositionReal().z - settings->fChannelWallThickness - settings->fChannelHeight + p->getRadiusReal());
-		for (auto n = std::next(p); n != vecP.end(); ++n)  // check overlap with neighbors
+		for (unsigned j = i + 1; j < n; ++j)  // check overlap with neighbors
 		{
-			float centerDist = p->getCenterDist(*n);
-			if (centerDist < p->getRadiusReal() + n->getRadiusReal())
-				correlation -= 0.01 * settings->nOverlapPenalty * ((double)centerDist - p->getRadiusReal() - n->getRadiusReal())
-									     * ((double)centerDist - p->getRadiusReal() - n->getRadiusReal());
+			const Particle* q = &vecP[j];
+			float centerDist = p->getCenterDist(*q);
+			if (centerDist < p->getRadiusReal() + q->getRadiusReal())
+				correlation -= 0.01 * settings->nOverlapPenalty * ((double)centerDist - p->getRadiusReal() - q->getRadiusReal())
+									     * ((double)centerDist - p->getRadiusReal() - q->getRadiusReal());
 		}
 	}
 
+	// keep the per particle correlations at the best point so they can be used as the confidences
+	if (correlation > d->dBestObjective)
+	{
+		d->dBestObjective = correlation;
+		std::copy(vecCorrelations.begin(), vecCorrelations.begin() + n, d->workspace->getBestCorrelations(n).begin());
+	}
+
 	return correlation;
 }
\ No newline at end of file
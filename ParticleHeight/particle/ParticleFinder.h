@@ -7,7 +7,10 @@
 #include "ray/OpticalSphere.h"
 #include "TransformSingle.h"
 #include "TransformMultiple.h"
+#include "EvalWorkspace.h"
+#include "util/FrameMetrics.h"
 #include "util/Settings.h"
+#include "util/TaskScheduler.h"
 #include "nlopt.hpp"
 #include <list>
 
@@ -16,17 +19,34 @@ namespace ph
 	class ParticleFinder
 	{
 	public:
-		ParticleFinder(const ImageProcessor* imp, const Settings* s, bool verbose = true) : m_pRefProcessor(imp), m_pSettings(s), m_bVerbose(verbose) {};
-		ParticleFinder() : m_pRefProcessor(nullptr), m_pSettings(nullptr), m_bVerbose(true) {};
+		ParticleFinder(const ImageProcessor* imp, const Settings* s, bool verbose = true) : m_pRefProcessor(imp), m_pSettings(s), m_pScheduler(nullptr), m_bVerbose(verbose) {};
+		ParticleFinder() : m_pRefProcessor(nullptr), m_pSettings(nullptr), m_pScheduler(nullptr), m_bVerbose(true) {};
 		~ParticleFinder() {};
 	public:
-		std::list<Particle> findParticles(cv::Mat matParticle, bool bUseHough = false);
+		void setScheduler(TaskScheduler* scheduler) { m_pScheduler = scheduler; };  // solve the particle heights as parallel tasks
+		// pMetrics optionally collects the time of each stage and the work done for the frame
+		std::list<Particle> findParticles(cv::Mat matParticle, bool bUseHough = false, const std::list<Particle>* pPrevious = nullptr, FrameMetrics* pMetrics = nullptr);
+		std::vector<cv::Vec3f> detectParticles(cv::Mat matParticle, bool bUseHough = false, FrameMetrics* pMetrics = nullptr) const;
+		std::list<Particle> solveParticles(cv::Mat matParticle, const std::vector<cv::Vec3f>& vecCircles, const std::list<Particle>* pPrevious = nullptr, FrameMetrics* pMetrics = nullptr);
 	private:
-		bool m_findHeightSingle(Particle*, cv::Mat matParticle, double& dConfidence, unsigned& nEvals);
-		bool m_findHeightGroup(std::vector<Particle*>, cv::Mat matParticle, double& dConfidence, unsigned& nEvals);
+		struct heightResult
+		{
+			bool bFound;
+			unsigned nEvals;
+			unsigned nInitEvals;
+			uint64_t nRays;
+		};
+	private:
+		heightResult m_findHeights(std::vector<Particle*>& vecpGroup, cv::Mat matParticle, const std::list<Particle>* pPrevious) const;
+		bool m_findHeightSingle(Particle*, cv::Mat matParticle, double& dConfidence, unsigned& nEvals, unsigned nMaxEvals = 0) const;
+		bool m_findHeightGroup(std::vector<Particle*>, cv::Mat matParticle, double& dConfidence, unsigned& nEvals, unsigned& nInitEvals, const std::list<Particle>* pPrevious) const;
+		bool m_seedFromPrevious(Particle*, const std::list<Particle>* pPrevious) const;
+		float m_estimateCost(size_t nGroupSize) const;
+		EvalWorkspace& m_getWorkspace() const;
 	private:
 		const ImageProcessor* m_pRefProcessor;
 		const Settings* m_pSettings;
+		TaskScheduler* m_pScheduler;
 	private:
 		bool m_bVerbose;
 	};
@@ -38,6 +58,8 @@ namespace ph
 		cv::Mat* matParticle;
 		OpticalScene* scene;
 		unsigned nEvals;
+		EvalWorkspace* workspace;  // scratch space so evaluating the objective doesn't allocate
+		double dBestObjective;  // best objective value so far, the group objective records the per particle correlations at this point
 	};
 
 	double correlateSingleParticle(unsigned n, const double* pos, double* grad, void* data);
@@ -1,6 +1,28 @@
 #include <opencv2/highgui.hpp>
 #include <iostream>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <deque>
+#include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <numeric>
+#include <random>
+#include <sstream>
+#include <thread>
+#include <sys/stat.h>
+#include "Checkpoint.h"
+#include "FlowStatistics.h"
+#include "FrameRenderer.h"
 #include "ParticleFinder.h"
+#include "ResultFile.h"
+#include "TrajectoryLinker.h"
+#include "image/FrameSource.h"
+#include "image/MaskFile.h"
+#include "util/FileIO.h"
+#include "util/QuadraticSurrogate.h"
 
 // window names
 std::string sViewerWindowName = "ParticleHeight";
@@ -29,21 +51,39 @@ bool bUseHoughTransform = false;
 void usage()
 {
 	// print the options for using the application
-	std::cerr << "USAGE: ParticleHeight {-h|-s[-r][n]|-c|-p[-r]} videoFile [refVideoFile] [settingsFile] [outCSV] [outVideo]" << std::endl;
+	std::cerr << "USAGE: ParticleHeight {-h|-s[-r][n]|-c|-p[-r][-u][-i x,y,w,h[mm]][-f first[:last]][-k stride][-o outStats][-m outMetrics][-j outTrace]|-x[-r][-a]|-e|-g} [-t n] videoFile [refVideoFile] [settingsFile] [outCSV] [outResults] [outMasks] [outVideo] [outStack]" << std::endl;
 	std::cerr << "                                                                                " << std::endl;
 	std::cerr << " -h | -help          print this help" << std::endl;
 	std::cerr << " -s | -setup         interactively configure the video processing settings" << std::endl;
 	std::cerr << "  n                   number of frames to load during setup (default 10)" << std::endl;
 	std::cerr << " -c | -calibrate     calibrate optical parameters using list of known particle heights" << std::endl;
 	std::cerr << " -p | -process       process a video or batch of videos" << std::endl;
+	std::cerr << " -u | -resume         continue an interrupted run from its last checkpoint (see CheckpointFrames)" << std::endl;
+	std::cerr << " -i | -roi            only search the region x,y,width,height of each frame, which also aligns it (pixels, or mm with an mm suffix)" << std::endl;
+	std::cerr << " -f | -frames         only process the frames from first to last (counted from 1 after the ref image)" << std::endl;
+	std::cerr << " -k | -stride         only process every k-th frame" << std::endl;
+	std::cerr << " -o | -statistics     write concentration profiles and velocity statistics to outStats (csv) while processing" << std::endl;
+	std::cerr << " -m | -metrics        write the time of each stage and the work done for each frame to outMetrics (.jsonl or .csv)" << std::endl;
+	std::cerr << " -j | -trace          write a timeline of the work done on every thread to outTrace (chrome trace event json)" << std::endl;
+	std::cerr << " -x | -convert       decode a video once into a frame stack that every mode can read faster" << std::endl;
+	std::cerr << " -a | -align          align the frames to the ref image while converting" << std::endl;
+	std::cerr << " -e | -export        write a binary results file (.phr) as outCSV, linking trajectories if settingsFile enables it," << std::endl;
+	std::cerr << "                     and a mask file (.phm) as outVideo" << std::endl;
+	std::cerr << " -g | -generate      render a synthetic video (outVideo or outStack) over the first frame of videoFile, with its ground truth as outCSV" << std::endl;
+	std::cerr << "                     particles are random unless a csv of positions (frame,x,y,z) is given before outCSV" << std::endl;
 	std::cerr << " -r | -ref           reference image is provided in separate file" << std::endl;
+	std::cerr << " -t | -threads n     number of threads to use (default all hardware threads)" << std::endl;
 	std::cerr << "                                                                                " << std::endl;
-	std::cerr << " videoFile            8-bit single channel AVI file, first frame can be ref image" << std::endl;
+	std::cerr << " videoFile            8-bit single channel AVI file or frame stack (.phs), first frame can be ref image" << std::endl;
 	std::cerr << "                          in processing mode, this can be a directory containing all videos to be processed" << std::endl;
+	std::cerr << "                          (each video's outputs are written next to it in the formats of the given outputs)" << std::endl;
 	std::cerr << " refVideoFile         AVI file named \"ref\" containing a single frame of the ref image, necessary if videoFile doesn't contain it" << std::endl;
 	std::cerr << " settingsFile         txt file from which processing settings are read, setup mode will write here" << std::endl;
 	std::cerr << " outCSV               stores the results from processing a video" << std::endl;
+	std::cerr << " outResults           binary results (.phr) with the group and evaluations of each particle, indexed by frame" << std::endl;
+	std::cerr << " outMasks             lossless run-length encoded particle masks (.phm), a compact replacement for outVideo" << std::endl;
 	std::cerr << " outVideo             stores a video illustrating the particle finding process for debugging" << std::endl;
+	std::cerr << " outStack             frame stack (.phs) written in convert mode, its first frame is the ref image" << std::endl;
 	exit(0);
 }
 
@@ -74,6 +114,12 @@ std::string getExt(const char* filename)
 		return "";
 }
 
+bool isVideoExt(const std::string& ext)
+{
+	// videos can be read from avi files or frame stacks
+	return ext == "avi" || ext == "phs";
+}
+
 void updateFrame()
 {
 	cv::Mat matShowFrame = vecVideoFrames[nCurrentFrame].clone();  // get a copy of the current frame
@@ -143,7 +189,7 @@ void updateFrame()
 				else
 				{
 					// use analytical model to transform the image
-					matTransformed = imProcessor->transformRef(rectRegion, ph::TransformSingle(&p, pSettings));
+					matTransformed = ph::applyTransformSingle(&p, pSettings, [&](const auto& t) { return imProcessor->transformRef(rectRegion, t); });
 
 					cv::putText(matShowFrame, "Analytical", cv::Point(3, 12), cv::FONT_HERSHEY_SIMPLEX, 0.5, cv::Scalar(0, 0, 200), 1, cv::LINE_AA);
 				}
@@ -193,12 +239,15 @@ void onTrackbarUpdate(int value, void* data)
 	updateFrame();
 }
 
-void configureSettings(std::string& sVideoIn, std::string& sRefVid, int nSetupFrames, std::string& sSettings)
+void configureSettings(std::string& sVideoIn, std::string& sRefVid, int nSetupFrames, std::string& sSettings, int nThreads)
 {
-	cv::VideoCapture cap(sVideoIn);  // create video capture object
+	// the viewer processes one frame at a time so opencv gets all the threads
+	ph::ThreadBudget::configure(nThreads, false);
+
+	ph::FrameSource cap(sVideoIn);  // open the video as grayscale frames, stays open while the frames are viewed
 	if (!cap.isOpened()) error("unable to open video");
+	if (cap.isAligned() && sRefVid != "") error("frame stack is aligned to its first frame, a separate reference video can't be used");
 
-	// read the ref image
 	// read the ref image
 	cv::Mat matFrame;
 	if (sRefVid == "")
@@ -209,12 +258,12 @@ void configureSettings(std::string& sVideoIn, std::string& sRefVid, int nSetupFr
 	else
 	{
 		// get the reference image from the provided reference video
-		cv::VideoCapture capRef(sRefVid);
-		if (!cap.isOpened()) error("unable to open reference video");
+		ph::FrameSource capRef(sRefVid);
+		if (!capRef.isOpened()) error("unable to open reference video");
 		capRef >> matFrame;
 		capRef.release();  // clean up the capture object
 	}
-	cv::cvtColor(matFrame, matFrame, cv::COLOR_BGR2GRAY);  // convert to grayscale
+	if (matFrame.empty()) error("no reference image");
 	vecVideoFrames.push_back(matFrame);  // store reference frame
 	sizeVideo = vecVideoFrames[0].size();  // get size of the reference frame
 
@@ -239,16 +288,19 @@ void configureSettings(std::string& sVideoIn, std::string& sRefVid, int nSetupFr
 	for (int n = 1; n < nSetupFrames; n++)
 	{
 		cap >> matFrame;  // store the next available frame
-		if (matFrame.empty()) break;  // check for video end
+		if (matFrame.empty())
+		{
+			if (cap.isDamaged()) error(("frame " + std::to_string(n) + " of the video can't be read").c_str());
+			break;  // check for video end
+		}
 
-		cv::cvtColor(matFrame, matFrame, cv::COLOR_BGR2GRAY);  // convert to grayscale
 		vecVideoFrames.push_back(matFrame);  // push the new frame
 
-		// align the frame to the ref image
-		std::cout << "aligned frame " << n << " with correlation coefficient " << imProcessor->alignToRef(matFrame) << "\r";
+		// align the frame to the ref image, unless the frame stack was aligned when it was written
+		double dAlignment = cap.isAligned() ? cap.getAlignment() : imProcessor->alignToRef(matFrame);
+		std::cout << "aligned frame " << n << " with correlation coefficient " << dAlignment << "\r";
 	}
 	std::cout << std::endl << "opened and aligned all " << vecVideoFrames.size() << " frames" << std::endl;
-	cap.release();  // release the video capture object
 
 	// create windows
 	cv::namedWindow(sViewerWindowName, cv::WINDOW_NORMAL);
@@ -347,134 +399,721 @@ void configureSettings(std::string& sVideoIn, std::string& sRefVid, int nSetupFr
 	// delete objects
 	delete pFinder;
 	delete imProcessor;
+	vecVideoFrames.clear();
+	cap.release();  // release the video capture object
 
 	// close the opencv window
 	cv::destroyAllWindows();
 }
 
-void processVideo(std::string& sVideoIn, std::string& sRefVid, std::string& sVideoOut, std::string& sOutput, std::string& sSettings)
+struct frameJob
 {
-	cv::VideoCapture cap(sVideoIn);  // create video capture object
-	if (!cap.isOpened()) error("unable to open video");
+	int n;  // frame number
+	cv::Mat matFrame;
+	double dAlignment;  // correlation coefficient of the alignment with the ref image
+	std::list<ph::Particle> listParticles;
+	cv::Mat matMask;  // binary image of the particles for the output video
+	cv::Mat matMaskRows, matMaskCols;  // particle pixels of each row and column of the binary image for the statistics
+	std::vector<char> vecMaskBlock;  // binary image encoded for the mask file
+	uint32_t nMaskEncoding;
+	ph::FrameMetrics metrics;
+	ph::TaskGroup tasks;
+};
 
-	// read the ref image
-	cv::Mat matRef;
-	if (sRefVid == "")
-	{
-		// separate ref video not provided so the ref image should be the first frame
-		cap >> matRef;
-	}
-	else
-	{
-		// get the reference image from the provided reference video
-		cv::VideoCapture capRef(sRefVid);
-		if (!cap.isOpened()) error("unable to open reference video");
-		capRef >> matRef;
-		capRef.release();  // clean up the capture object
-	}
-	cv::cvtColor(matRef, matRef, cv::COLOR_BGR2GRAY);  // convert ref image to grayscale
+struct videoJob
+{
+	std::string sVideoIn;
+	std::string sVideoOut, sOutput, sResultsOut, sStatsOut, sMaskOut, sMetricsOut;  // empty if that output isn't written
+	int nFrames;
+	double dSeconds;
+	bool bFailed = false;  // a batch video that stopped partway, whose checkpoint is kept to resume it
+};
 
-	// create the image processor and particle finder objects
-	ph::Settings settings;
-	if (sSettings != "")
+struct runOptions
+{
+	bool bResume = false;  // continue each video from its last checkpoint
+	cv::Rect2f rectROI;  // region of interest along the image columns and rows, the whole frame if empty
+	bool bROIInMM = false;  // rectROI is in mm rather than pixels
+	int nFirstFrame = 1;  // frames are counted from 1 after the ref image
+	int nLastFrame = 0;  // 0 for the end of the video
+	int nStride = 1;  // every nStride-th frame from nFirstFrame is processed
+	bool bBatch = false;  // the video is part of a batch, whose finished videos keep a checkpoint until the whole batch is done
+};
+
+struct videoFailure : std::runtime_error
+{
+	// a problem with one video of a batch, which is reported and skipped instead of ending the batch
+	videoFailure(const std::string& msg) : std::runtime_error(msg) {};
+};
+
+void videoError(const runOptions& options, const std::string& msg)
+{
+	if (!options.bBatch)
+		error(msg.c_str());
+	throw videoFailure(msg);
+}
+
+cv::Rect getROI(const runOptions& options, const ph::Settings& settings, cv::Size frameSize)
+{
+	// the region of interest in pixels, clipped to the frame
+	cv::Rect rectFrame(0, 0, frameSize.width, frameSize.height);
+	if (options.rectROI.width <= 0 || options.rectROI.height <= 0)
+		return rectFrame;
+
+	float fScale = options.bROIInMM ? settings.fPxPerMM : 1.0f;
+	int x = (int)floor(options.rectROI.x * fScale);
+	int y = (int)floor(options.rectROI.y * fScale);
+	cv::Rect rectROI(x, y, (int)ceil((options.rectROI.x + options.rectROI.width) * fScale) - x, (int)ceil((options.rectROI.y + options.rectROI.height) * fScale) - y);
+	rectROI &= rectFrame;
+	if (rectROI.area() <= 0)
+		error("the region of interest is outside the frame");
+	return rectROI;
+}
+
+std::string getCheckpointPath(const videoJob& video)
+{
+	// the checkpoint is kept next to the first output that can be resumed
+	for (const std::string* pOutput : { &video.sOutput, &video.sResultsOut, &video.sMaskOut, &video.sStatsOut, &video.sMetricsOut })
+		if (*pOutput != "")
+			return *pOutput + ".ckpt";
+	return "";
+}
+
+void processFrames(ph::FrameSource& cap, const ph::ImageProcessor& imProcessor, videoJob& video, const ph::Settings& settings, ph::TaskScheduler& scheduler, bool bVerbose, const runOptions& options)
+{
+	// find the particles in the selected frames of the rest of cap and write the outputs of the video
+	// when resuming, the run continues from the video's last checkpoint if it has one
+	auto startTime = std::chrono::high_resolution_clock::now();
+	bool bPreAligned = cap.isAligned();
+
+	// a region of interest is searched for circles on its own, but the particles are solved in the full frame so their positions,
+	// and every output except the binary images of the region, stay in full frame coordinates. the whole frame is aligned with
+	// the warp found in the region so the solve doesn't see aligned and unaligned pixels side by side
+	cv::Rect rectROI = getROI(options, settings, imProcessor.getRef().size());
+	std::unique_ptr<ph::ImageProcessor> pROIProcessor;
+	if (rectROI.size() != imProcessor.getRef().size())
+		pROIProcessor.reset(new ph::ImageProcessor(imProcessor.getRef()(rectROI).clone(), &settings));
+	const ph::ImageProcessor& imROIProcessor = pROIProcessor ? *pROIProcessor : imProcessor;
+	ph::ParticleFinder pDetector(&imROIProcessor, &settings, false);
+
+	// checkpoints are written every few frames, but the mask video can't be appended to so it turns them off
+	std::string sCheckpoint = getCheckpointPath(video);
+	bool bCheckpoint = (settings.nCheckpointFrames > 0 && video.sVideoOut == "" && sCheckpoint != "");
+	ph::Checkpoint checkpoint, checkpointRun;
+	checkpointRun.nFirstFrame = options.nFirstFrame;
+	checkpointRun.nLastFrame = options.nLastFrame;
+	checkpointRun.nStride = options.nStride;
+	checkpointRun.nROI[0] = rectROI.x;
+	checkpointRun.nROI[1] = rectROI.y;
+	checkpointRun.nROI[2] = rectROI.width;
+	checkpointRun.nROI[3] = rectROI.height;
+	checkpointRun.nSettingsHash = settings.getHash();
+	bool bResumed = false;
+	if (options.bResume)
 	{
-		settings.setFile(sSettings.c_str());
-		int l = settings.load();
-		if (l < 0)
-			std::cout << "failed to open settings file, using defaults" << std::endl;
+		if (video.sVideoOut != "") videoError(options, "a run writing a mask video can't be resumed, write a .phm mask file instead");
+		if (checkpoint.load(sCheckpoint))
+		{
+			if (!checkpoint.isSameRun(checkpointRun))
+				videoError(options, "the frames, region of interest or settings differ from those of the checkpointed run");
+			if (checkpoint.bComplete)
+			{
+				std::cout << video.sVideoIn << " was already processed" << std::endl;
+				video.nFrames = 0;
+				video.dSeconds = 0;
+				return;
+			}
+			if ((video.sOutput != "") != (checkpoint.nCSVOffset >= 0) || (video.sResultsOut != "") != (checkpoint.nResultsOffset >= 0)
+				|| (video.sMaskOut != "") != (checkpoint.nMaskOffset >= 0) || (video.sMetricsOut != "") != (checkpoint.nMetricsOffset >= 0)
+				|| (video.sStatsOut != "") != (checkpoint.sStatistics != ""))
+				videoError(options, "the outputs differ from those of the checkpointed run");
+			if (!cap.skip(checkpoint.nFrames))
+				videoError(options, "the video is shorter than the checkpointed run");
+			bResumed = true;
+			std::cout << "resuming " << video.sVideoIn << " after frame " << checkpoint.nFrames << std::endl;
+		}
 		else
-			std::cout << "opened settings file, loaded " << l << " setting values" << std::endl;
+			std::cout << "no checkpoint found for " << video.sVideoIn << ", starting from the first frame" << std::endl;
 	}
 
-	// create objects and pass settings
-	ph::ImageProcessor imProcessor(matRef, &settings);
-	ph::ParticleFinder pFinder(&imProcessor, &settings);
-	ph::Particle::setSettings(&settings);
+	// the particle finder only reports on each frame when frames aren't processed concurrently
+	bool bSeedFromPrevious = (settings.nGroupInitMode == ph::Settings::GROUP_INIT_PREVIOUS_FRAME);
+	ph::ParticleFinder pFinder(&imProcessor, &settings, bVerbose && bSeedFromPrevious);
+	pFinder.setScheduler(&scheduler);
 
 	// open file to save results
 	std::ofstream outputFile;
 	bool bWriteCSV = false;
-	if (sOutput != "")
+	if (video.sOutput != "")
 	{
-		outputFile.open(sOutput);
+		if (!bResumed)
+			outputFile.open(video.sOutput);
+		else if (ph::truncateFile(video.sOutput, checkpoint.nCSVOffset))
+			outputFile.open(video.sOutput, std::ios::in | std::ios::out | std::ios::ate);
 		if (outputFile.is_open())
 		{
 			bWriteCSV = true;
-			outputFile << "frame,x,y,z,confidence\n";
+			if (!bResumed)
+				outputFile << (settings.bLinkTrajectories ? "frame,x,y,z,confidence,particle\n" : "frame,x,y,z,confidence\n");
 		}
 		else
-			error("could not open output file");
+			videoError(options, "could not open output file");
+	}
+
+	// trajectories are linked as the frames are written, in place of the linking script
+	ph::TrajectoryLinker linker(settings.fLinkMaxDisplacement, settings.nLinkMaxSubnetSize);
+
+	// profiles and velocities are accumulated as the frames are written, the velocities need the linked trajectories
+	ph::FlowStatistics statistics(&settings, imProcessor.getRef().size(), rectROI);
+	bool bWriteStats = (video.sStatsOut != "");
+	bool bLink = settings.bLinkTrajectories || bWriteStats;
+	if (bResumed)
+	{
+		std::istringstream linkerState(checkpoint.sLinker), statisticsState(checkpoint.sStatistics);
+		if (bLink && !linker.load(linkerState))
+			videoError(options, "the checkpoint has no trajectories to link to");
+		if (bWriteStats && !statistics.load(statisticsState))
+			videoError(options, "the checkpointed statistics don't match the settings");
+	}
+
+	// binary results are written by a background thread
+	ph::ResultWriter resultWriter;
+	bool bWriteResults = false;
+	if (video.sResultsOut != "")
+	{
+		if (bResumed ? resultWriter.resume(video.sResultsOut, &settings, checkpoint.nResultsOffset, checkpoint.vecResultIndex) : resultWriter.open(video.sResultsOut, &settings))
+			bWriteResults = true;
+		else
+			videoError(options, "could not open results file");
 	}
 	
+	// binary masks are encoded by the frame tasks and written losslessly by a background thread
+	ph::MaskWriter maskWriter;
+	bool bWriteMasks = false;
+	if (video.sMaskOut != "")
+	{
+		if (bResumed ? maskWriter.resume(video.sMaskOut, rectROI.size(), checkpoint.nMaskOffset, checkpoint.vecMaskIndex) : maskWriter.open(video.sMaskOut, rectROI.size()))
+			bWriteMasks = true;
+		else
+			videoError(options, "could not open mask file");
+	}
+
+	// per frame metrics of each stage
+	ph::MetricsWriter metricsWriter;
+	bool bWriteMetrics = false;
+	if (video.sMetricsOut != "")
+	{
+		if (bResumed ? metricsWriter.resume(video.sMetricsOut, checkpoint.nMetricsOffset) : metricsWriter.open(video.sMetricsOut))
+			bWriteMetrics = true;
+		else
+			videoError(options, "could not open metrics file");
+	}
+
 	// get the video writer ready
 	cv::VideoWriter writer;
 	bool bWriteVideo = false;
-	if (sVideoOut != "")
+	if (video.sVideoOut != "")
 	{
 		int codec = cv::VideoWriter::fourcc('M', 'J', 'P', 'G');
 		double fps = 30.0;
-		writer.open(sVideoOut, codec, fps, matRef.size());
+		writer.open(video.sVideoOut, codec, fps, rectROI.size());
 
 		if (writer.isOpened())
 			bWriteVideo = true;
 		else
-			error("unable to open output video writer");
+			videoError(options, "unable to open output video writer");
 	}
 
-	// read the rest of the frames
-	int n = 1;
-	while (true)
+	// frames are processed as parallel tasks, with the particle heights of each frame as subtasks, and written in order as they finish
+	// seeding the groups from the previous frame needs its results first so then only the particles of one frame run in parallel
+	size_t nMaxFramesInFlight = bSeedFromPrevious ? 1 : 2 * scheduler.getNumThreads();
+	std::deque<std::unique_ptr<frameJob>> queueJobs;
+	std::list<ph::Particle> listPrevious;  // particles from the previous frame, can seed the group heights
+	for (size_t i = 0; i < checkpoint.vecPrevious.size(); i++)
 	{
-		cv::Mat matFrame;
-		cap >> matFrame;  // store the next available frame
-		if (matFrame.empty()) break;  // check for video end
+		listPrevious.emplace_back();
+		listPrevious.back().setPosition(checkpoint.vecPrevious[i]);
+		listPrevious.back().setHeightKnown(checkpoint.vecPreviousKnown[i] != 0);
+	}
 
-		cv::cvtColor(matFrame, matFrame, cv::COLOR_BGR2GRAY);  // convert to grayscale
+	auto saveCheckpoint = [&](int nFrames)
+	{
+		// sync the outputs so everything up to nFrames is on disk, then save where each one ends and the state carried to the next frame
+		ph::TraceScope trace("checkpoint", nFrames);
+		ph::Checkpoint cp = checkpointRun;
+		cp.nFrames = nFrames;
+		if (bWriteCSV)
+		{
+			outputFile.flush();
+			cp.nCSVOffset = (int64_t)outputFile.tellp();
+		}
+		if (bWriteResults)
+		{
+			if (!resultWriter.sync()) videoError(options, "failed to write results file");
+			cp.nResultsOffset = (int64_t)resultWriter.getOffset();
+			cp.vecResultIndex = resultWriter.getIndex();
+		}
+		if (bWriteMasks)
+		{
+			if (!maskWriter.sync()) videoError(options, "failed to write mask file");
+			cp.nMaskOffset = (int64_t)maskWriter.getOffset();
+			cp.vecMaskIndex = maskWriter.getIndex();
+		}
+		if (bWriteMetrics)
+		{
+			if (!metricsWriter.sync()) videoError(options, "failed to write metrics file");
+			cp.nMetricsOffset = (int64_t)metricsWriter.getOffset();
+		}
+		if (bLink)
+		{
+			std::ostringstream linkerState;
+			linker.save(linkerState);
+			cp.sLinker = linkerState.str();
+		}
+		if (bWriteStats)
+		{
+			std::ostringstream statisticsState;
+			statistics.save(statisticsState);
+			cp.sStatistics = statisticsState.str();
+		}
+		for (auto& p : listPrevious)
+		{
+			cp.vecPrevious.push_back(p.getPositionReal());
+			cp.vecPreviousKnown.push_back(p.isHeightKnown());
+		}
+		if (!cp.save(sCheckpoint))
+			videoError(options, "failed to write checkpoint");
+	};
 
-		std::cout << "processing frame " << n << std::endl;
+	int nWritten = 0, nLastWritten = bResumed ? checkpoint.nFrames : 0;
+	auto writeOldestFrame = [&]()
+	{
+		frameJob& job = *queueJobs.front();
+		{
+			ph::TraceScope trace("wait", job.n);
+			scheduler.wait(job.tasks);
+		}
+		auto outputTime = std::chrono::steady_clock::now();
 
-		// align the frame to the ref image
-		std::cout << "aligned frame with correlation coefficient " << imProcessor.alignToRef(matFrame) << std::endl;
+		if (bVerbose)
+			std::cout << "processed frame " << job.n << ", aligned with correlation coefficient " << job.dAlignment << std::endl;
+
+		// write to csv file
+		// convert to the coordinate system in the paper
+		std::vector<ph::vf3> vecPositions;
+		for (auto& p : job.listParticles)
+			vecPositions.push_back(ph::vf3(p.getPositionReal().y, p.getPositionReal().z - settings.fChannelWallThickness, p.getPositionReal().x));
+		std::vector<int> vecIds;
+		if (bLink)
+			vecIds = linker.link(vecPositions);
 
-		// find the particles
 		if (bWriteCSV)
 		{
-			std::list<ph::Particle> listParticles = pFinder.findParticles(matFrame);
-
-			// write to csv file
-			// convert to the coordinate system in the paper
-			for (auto& p : listParticles)
-				outputFile << n << ","
-				<< p.getPositionReal().y << ","
-				<< p.getPositionReal().z - settings.fChannelWallThickness << ","
-				<< p.getPositionReal().x << ","
-				<< p.getConfidence() << "\n";
+			size_t i = 0;
+			for (auto& p : job.listParticles)
+			{
+				outputFile << job.n << ","
+				<< vecPositions[i].x << ","
+				<< vecPositions[i].y << ","
+				<< vecPositions[i].z << ","
+				<< p.getConfidence();
+				if (settings.bLinkTrajectories)
+					outputFile << "," << vecIds[i];
+				outputFile << "\n";
+				i++;
+			}
+		}
+		if (bWriteStats)
+		{
+			statistics.addMask(job.matMaskRows, job.matMaskCols);
+			statistics.addParticles(vecPositions, vecIds);
 		}
+		if (bWriteResults)
+			resultWriter.write(job.n, job.listParticles);
 
 		// write the processed frame
 		if (bWriteVideo)
+			writer.write(job.matMask);
+		if (bWriteMasks)
+			maskWriter.write(job.n, job.nMaskEncoding, std::move(job.vecMaskBlock));
+
+		auto outputEndTime = std::chrono::steady_clock::now();
+		ph::TraceRecorder::record("output", outputTime, outputEndTime, job.n);
+		if (bWriteMetrics)
 		{
-			// save the frame as a binary image of the particles from which concentration profiles or spatiotemporal plots can be made
-			imProcessor.subtractBackground(matFrame);
-			imProcessor.morphClose(matFrame);
-			imProcessor.morphOpen(matFrame);
-			cv::cvtColor(matFrame, matFrame, cv::COLOR_GRAY2RGB);
-			writer.write(matFrame);
+			job.metrics.dAlignment = job.dAlignment;
+			job.metrics.dStageMs[ph::FrameMetrics::STAGE_OUTPUT] += std::chrono::duration<double, std::milli>(outputEndTime - outputTime).count();
+			metricsWriter.write(job.metrics);
 		}
 
-		n++;
+		listPrevious = std::move(job.listParticles);
+		nLastWritten = job.n;
+		if (bCheckpoint && ++nWritten % settings.nCheckpointFrames == 0)
+			saveCheckpoint(job.n);
+		queueJobs.pop_front();
+	};
+	auto finishOldestFrame = [&]()
+	{
+		try
+		{
+			writeOldestFrame();
+		}
+		catch (...)
+		{
+			// the other frames in flight use this function's state, so they have to finish before the failure is passed on
+			for (auto& pJob : queueJobs)
+				try { scheduler.wait(pJob->tasks); } catch (...) {}
+			throw;
+		}
+	};
+
+	// read the rest of the selected frames, skipping the ones in between
+	int n = bResumed ? checkpoint.nFrames + options.nStride : options.nFirstFrame;
+	int nSkip = bResumed ? options.nStride - 1 : n - 1;
+	int nFrames = 0;
+	bool bDamaged = false;
+	while (options.nLastFrame <= 0 || n <= options.nLastFrame)
+	{
+		cv::Mat matFrame;
+		auto decodeTime = std::chrono::steady_clock::now();
+		if (nSkip > 0)
+			cap.skip(nSkip);  // if the video ends first there is no frame to read
+		cap >> matFrame;  // store the next available frame
+		if (matFrame.empty())
+		{
+			bDamaged = cap.isDamaged();  // reported once the frames before it are written
+			break;  // check for video end
+		}
+		auto decodeEndTime = std::chrono::steady_clock::now();
+		double dDecodeMs = std::chrono::duration<double, std::milli>(decodeEndTime - decodeTime).count();
+		ph::TraceRecorder::record("decode", decodeTime, decodeEndTime, n);
+
+		if (queueJobs.size() >= nMaxFramesInFlight)
+			finishOldestFrame();
+
+		queueJobs.emplace_back(new frameJob());
+		frameJob* pJob = queueJobs.back().get();
+		pJob->n = n;
+		pJob->metrics.nFrame = n;
+		pJob->matFrame = matFrame;
+		pJob->dAlignment = cap.getAlignment();
+		pJob->metrics.dStageMs[ph::FrameMetrics::STAGE_DECODE] = dDecodeMs - cap.getConvertMs();
+		pJob->metrics.dStageMs[ph::FrameMetrics::STAGE_CONVERT] = cap.getConvertMs();
+		const std::list<ph::Particle>* pPrevious = bSeedFromPrevious ? &listPrevious : nullptr;
+		ph::FrameMetrics* pMetrics = (bWriteMetrics || ph::TraceRecorder::isRecording()) ? &pJob->metrics : nullptr;
+
+		// frames get the largest cost so they are started before the particle tasks and keep all the workers busy
+		scheduler.submit(pJob->tasks, [&, pJob, pPrevious, pMetrics]()
+			{
+				ph::TraceScope trace("frame", pJob->n);
+
+				// align the frame to the ref image using the region of interest
+				cv::Mat matROI = pJob->matFrame(rectROI);
+				if (!bPreAligned)
+				{
+					ph::StageTimer timer(pMetrics, ph::FrameMetrics::STAGE_ALIGN);
+					cv::Mat matWarp;
+					pJob->dAlignment = imROIProcessor.alignToRef(pJob->matFrame, rectROI.tl(), matWarp, bWriteMetrics ? &pJob->metrics.nAlignIterations : nullptr);
+				}
+
+				// find the circles in the region and solve the particles in the full frame
+				if (bWriteCSV || bWriteResults || bWriteStats)
+				{
+					std::vector<cv::Vec3f> vecCircles = pDetector.detectParticles(matROI, false, pMetrics);
+					for (auto& c : vecCircles)
+					{
+						c[0] += rectROI.x;
+						c[1] += rectROI.y;
+					}
+					pJob->listParticles = pFinder.solveParticles(pJob->matFrame, vecCircles, pPrevious, pMetrics);
+				}
+
+				if (bWriteVideo || bWriteStats || bWriteMasks)
+				{
+					// binary image of the particles from which concentration profiles or spatiotemporal plots can be made
+					// made from a copy of the region, the morphology of a view would read the frame's pixels around it
+					cv::Mat matMask = matROI.clone();
+					{
+						ph::StageTimer timer(pMetrics, ph::FrameMetrics::STAGE_BACKGROUND);
+						imROIProcessor.subtractBackground(matMask);
+					}
+					{
+						ph::StageTimer timer(pMetrics, ph::FrameMetrics::STAGE_MORPHOLOGY);
+						imROIProcessor.morphClose(matMask);
+						imROIProcessor.morphOpen(matMask);
+					}
+					ph::StageTimer timer(pMetrics, ph::FrameMetrics::STAGE_OUTPUT);
+					if (bWriteStats)
+						ph::FlowStatistics::reduceMask(matMask, pJob->matMaskRows, pJob->matMaskCols);
+					if (bWriteMasks)
+						pJob->nMaskEncoding = ph::MaskWriter::encode(matMask, pJob->vecMaskBlock);
+					if (bWriteVideo)
+						cv::cvtColor(matMask, pJob->matMask, cv::COLOR_GRAY2RGB);
+				}
+			}, std::numeric_limits<float>::max());
+
+		nFrames++;
+		n += options.nStride;
+		nSkip = options.nStride - 1;
 	}
 
-	std::cout << "finished processing video" << std::endl;
+	while (!queueJobs.empty())
+		finishOldestFrame();
+
 	outputFile.close();  // close the output file
+	if (bWriteResults && !resultWriter.close())
+		videoError(options, "failed to write results file");
+	if (bWriteStats && !statistics.write(video.sStatsOut))
+		videoError(options, "failed to write statistics file");
+	if (bWriteMasks && !maskWriter.close())
+		videoError(options, "failed to write mask file");
+	if (bWriteMetrics)
+	{
+		if (!metricsWriter.close())
+			videoError(options, "failed to write metrics file");
+		if (bVerbose)
+			metricsWriter.printSummary(std::cout);
+	}
+	if (bDamaged)
+		videoError(options, "frame " + std::to_string(n) + " of the video can't be read");
+
+	// a finished video in a batch keeps a last checkpoint marking it as done, so resuming the batch skips it
+	// a single video has nothing left to resume
+	if (bCheckpoint && options.bBatch)
+	{
+		ph::Checkpoint cp = checkpointRun;
+		cp.nFrames = nLastWritten;
+		cp.bComplete = true;
+		if (!cp.save(sCheckpoint))
+			videoError(options, "failed to write checkpoint");
+	}
+	else if (bCheckpoint)
+		std::remove(sCheckpoint.c_str());
+
+	auto endTime = std::chrono::high_resolution_clock::now();
+	video.nFrames = nFrames;
+	video.dSeconds = std::chrono::duration_cast<std::chrono::milliseconds>(endTime - startTime).count() / 1000.0;
+}
+
+void processVideo(videoJob& video, std::string& sRefVid, std::string& sSettings, int nThreads, const runOptions& options)
+{
+	auto startTime = std::chrono::high_resolution_clock::now();
+
+	ph::FrameSource cap(video.sVideoIn);  // open the video as grayscale frames
+	if (!cap.isOpened()) error("unable to open video");
+	if (cap.isAligned() && sRefVid != "") error("frame stack is aligned to its first frame, a separate reference video can't be used");
+	if (cap.isMapped())
+		std::cout << "reading mapped frame stack" << (cap.isAligned() ? " with stored alignment" : "") << std::endl;
+	else
+		std::cout << (cap.isNative() ? "reading uncompressed 8-bit frames directly" : "decoding video with opencv") << std::endl;
+
+	// read the ref image
+	cv::Mat matRef;
+	if (sRefVid == "")
+	{
+		// separate ref video not provided so the ref image should be the first frame
+		cap >> matRef;
+	}
+	else
+	{
+		// get the reference image from the provided reference video
+		ph::FrameSource capRef(sRefVid);
+		if (!capRef.isOpened()) error("unable to open reference video");
+		capRef >> matRef;
+		capRef.release();  // clean up the capture object
+	}
+	if (matRef.empty()) error("no reference image");
+
+	// create the image processor and particle finder objects
+	ph::Settings settings;
+	if (sSettings != "")
+	{
+		settings.setFile(sSettings.c_str());
+		int l = settings.load();
+		if (l < 0)
+			std::cout << "failed to open settings file, using defaults" << std::endl;
+		else
+			std::cout << "opened settings file, loaded " << l << " setting values" << std::endl;
+	}
+
+	// create objects and pass settings
+	ph::ImageProcessor imProcessor(matRef, &settings);
+	ph::Particle::setSettings(&settings);
+
+	// with seeding from the previous frame the frames run one at a time, so opencv gets the threads the frames don't use
+	bool bSeedFromPrevious = (settings.nGroupInitMode == ph::Settings::GROUP_INIT_PREVIOUS_FRAME);
+	ph::ThreadBudget::configure(nThreads, !bSeedFromPrevious);
+	ph::ThreadBudget::printSummary(std::cout);
+	ph::TaskScheduler scheduler(ph::ThreadBudget::getWorkerThreads());
+
+	processFrames(cap, imProcessor, video, settings, scheduler, true, options);
+
+	// print the run summary
+	auto endTime = std::chrono::high_resolution_clock::now();
+	double dSeconds = std::chrono::duration_cast<std::chrono::milliseconds>(endTime - startTime).count() / 1000.0;
+	std::cout << "finished processing video: " << video.nFrames << " frames in " << dSeconds << " s (" << video.nFrames / std::max(dSeconds, 0.001) << " frames/s)" << std::endl;
+	ph::ThreadBudget::printSummary(std::cout);
 	cap.release();  // release the video capture object
 }
 
+bool isDirectory(const std::string& path)
+{
+	struct stat st;
+	return stat(path.c_str(), &st) == 0 && (st.st_mode & S_IFDIR);
+}
+
+void processBatch(std::string& sDirIn, const videoJob& outputs, std::string& sSettings, int nThreads, const runOptions& options)
+{
+	// process every video in a directory and its subdirectories, writing each video's outputs next to it
+	// the outputs that are set select the formats written for each video
+	// a video named "ref" is the ref image of every other video in its directory, otherwise a video's first frame is its ref image
+	auto startTime = std::chrono::high_resolution_clock::now();
+
+	std::vector<cv::String> vecFiles, vecStacks;
+	cv::glob(sDirIn + "/*.avi", vecFiles, true);
+	cv::glob(sDirIn + "/*.phs", vecStacks, true);
+	vecFiles.insert(vecFiles.end(), vecStacks.begin(), vecStacks.end());
+
+	// load the settings shared by every video
+	ph::Settings settings;
+	if (sSettings != "")
+	{
+		settings.setFile(sSettings.c_str());
+		int l = settings.load();
+		if (l < 0)
+			std::cout << "failed to open settings file, using defaults" << std::endl;
+		else
+			std::cout << "opened settings file, loaded " << l << " setting values" << std::endl;
+	}
+	ph::Particle::setSettings(&settings);
+
+	// read each directory's ref video once, its image processor is shared by all of the directory's videos
+	// mask videos from earlier runs aren't inputs
+	std::map<std::string, std::shared_ptr<ph::ImageProcessor>> mapRefs;
+	std::vector<videoJob> vecVideos;
+	std::vector<std::string> vecDirs;
+	std::vector<double> vecSizes;
+	for (const std::string& sFile : vecFiles)
+	{
+		size_t iSlash = sFile.find_last_of("/\\");
+		std::string sDir = (iSlash == std::string::npos) ? "" : sFile.substr(0, iSlash);
+		std::string sBase = sFile.substr(0, sFile.size() - 4);  // without the extension
+		std::string sName = sBase.substr(iSlash == std::string::npos ? 0 : iSlash + 1);
+
+		if (sName == "ref")
+		{
+			ph::FrameSource capRef(sFile);
+			cv::Mat matRef;
+			capRef >> matRef;
+			if (matRef.empty()) error(("unable to read reference video " + sFile).c_str());
+			mapRefs[sDir] = std::make_shared<ph::ImageProcessor>(matRef.clone(), &settings);
+		}
+		else if (sName.size() < 5 || sName.substr(sName.size() - 5) != "_mask")
+		{
+			vecVideos.push_back({ sFile, (outputs.sVideoOut != "") ? sBase + "_mask.avi" : "", (outputs.sOutput != "") ? sBase + ".csv" : "",
+				(outputs.sResultsOut != "") ? sBase + ".phr" : "", (outputs.sStatsOut != "") ? sBase + "_stats.csv" : "",
+				(outputs.sMaskOut != "") ? sBase + "_mask.phm" : "", (outputs.sMetricsOut != "") ? sBase + (getExt(outputs.sMetricsOut.c_str()) == "csv" ? "_metrics.csv" : "_metrics.jsonl") : "", 0, 0 });
+			vecDirs.push_back(sDir);
+			struct stat st;
+			vecSizes.push_back(stat(sFile.c_str(), &st) == 0 ? (double)st.st_size : 0.0);
+		}
+	}
+	if (vecVideos.empty()) error("no videos found in the directory");
+	std::cout << "found " << vecVideos.size() << " videos and " << mapRefs.size() << " reference videos" << std::endl;
+
+	// the whole batch shares one scheduler. each video is a task with a cost below any frame or particle task, so the workers
+	// finish the frames of the videos already started before starting another one: a large video spreads its frames over every
+	// worker while small videos end up running concurrently. the largest videos are started first
+	ph::ThreadBudget::configure(nThreads, true);
+	ph::ThreadBudget::printSummary(std::cout);
+	ph::TaskScheduler scheduler(ph::ThreadBudget::getWorkerThreads());
+	double dLargest = std::max(1.0, *std::max_element(vecSizes.begin(), vecSizes.end()));
+	std::mutex mutexOutput;
+	ph::TaskGroup tasks;
+	runOptions videoOptions = options;
+	videoOptions.bBatch = true;
+	for (size_t i = 0; i < vecVideos.size(); i++)
+		scheduler.submit(tasks, [&, i]()
+			{
+				ph::TraceScope trace("video", (int)i);
+				videoJob& video = vecVideos[i];
+				ph::FrameSource cap(video.sVideoIn);
+				auto itRef = mapRefs.find(vecDirs[i]);
+				if (!cap.isOpened() || (cap.isAligned() && itRef != mapRefs.end()))
+				{
+					std::lock_guard<std::mutex> lock(mutexOutput);
+					std::cout << "skipped " << video.sVideoIn << ": unable to open it with its reference" << std::endl;
+					return;
+				}
+
+				// use the cached ref processor, or the video's own first frame
+				std::shared_ptr<ph::ImageProcessor> pProcessor;
+				if (itRef != mapRefs.end())
+					pProcessor = itRef->second;
+				else
+				{
+					cv::Mat matRef;
+					cap >> matRef;
+					if (matRef.empty())
+					{
+						std::lock_guard<std::mutex> lock(mutexOutput);
+						std::cout << "skipped " << video.sVideoIn << ": unable to read its reference image" << std::endl;
+						return;
+					}
+					pProcessor = std::make_shared<ph::ImageProcessor>(matRef, &settings);
+				}
+
+				// a problem with the video only skips it, the other videos go on
+				try
+				{
+					processFrames(cap, *pProcessor, video, settings, scheduler, false, videoOptions);
+				}
+				catch (const std::exception& e)
+				{
+					std::lock_guard<std::mutex> lock(mutexOutput);
+					std::cout << "skipped " << video.sVideoIn << ": " << e.what() << std::endl;
+					video.nFrames = 0;
+					video.bFailed = true;
+					return;
+				}
+
+				std::lock_guard<std::mutex> lock(mutexOutput);
+				std::cout << "finished " << video.sVideoIn << ": " << video.nFrames << " frames in " << video.dSeconds << " s" << std::endl;
+			}, (float)(vecSizes[i] / dLargest));
+	scheduler.wait(tasks);
+
+	// every other video is done, so the checkpoints marking them as done aren't needed
+	for (auto& video : vecVideos)
+		if (!video.bFailed && getCheckpointPath(video) != "")
+			std::remove(getCheckpointPath(video).c_str());
+
+	// print and save the batch summary
+	auto endTime = std::chrono::high_resolution_clock::now();
+	double dSeconds = std::chrono::duration_cast<std::chrono::milliseconds>(endTime - startTime).count() / 1000.0;
+	int nTotalFrames = 0;
+	std::ofstream summaryFile(sDirIn + "/batch_summary.csv");
+	summaryFile << "video,frames,seconds,frames_per_second\n";
+	for (auto& video : vecVideos)
+	{
+		nTotalFrames += video.nFrames;
+		summaryFile << video.sVideoIn << "," << video.nFrames << "," << video.dSeconds << "," << video.nFrames / std::max(video.dSeconds, 0.001) << "\n";
+	}
+	std::cout << "finished processing batch: " << vecVideos.size() << " videos, " << nTotalFrames << " frames in " << dSeconds << " s ("
+		<< nTotalFrames / std::max(dSeconds, 0.001) << " frames/s)" << std::endl;
+	ph::ThreadBudget::printSummary(std::cout);
+}
+
 struct calibrateData
 {
-	ph::Settings* settings;
+	const ph::Settings* settings;  // shared by the workers, each evaluation uses its own copy with the trial parameters
+	ph::TaskScheduler* scheduler;
 	std::vector<cv::Mat> vecFrames;
 	std::vector<float> vecHeight;
+	std::vector<ph::ImageProcessor> vecProcessors;  // one per trial, with the trial's ref image
+	std::vector<std::vector<cv::Vec3f>> vecCircles;  // particles detected in each frame, these don't change with the optical parameters
+	std::mutex mutexEvaluations;
+	std::vector<std::vector<double>> vecEvaluatedParams;  // every parameter set passed to the objective, for the surrogate
+	std::vector<double> vecEvaluatedSSR;
 };
 
 double calculateHeightResiduals(unsigned n, const double* param, double* grad, void* data)
@@ -483,30 +1122,41 @@ double calculateHeightResiduals(unsigned n, const double* param, double* grad, v
 	// data -- vector of heights, vector of video frames, pointer to settings object
 
 	calibrateData* d = (calibrateData*)data;
-	ph::Settings* s = d->settings;
-
-	// update the settings with the passed parameters
-	s->fEtaGlass = param[0];
-	s->fEtaLiquid = param[1];
-	s->fEtaParticle = param[2];
-	s->fChannelWallThickness = param[3];
 
 	int nHeights = d->vecHeight.size();
 	int nTrials = d->vecFrames.size() / (nHeights + 1);
 
-	double ssr = 0;
+	// solve every calibration frame as a parallel task
+	std::vector<double> vecResiduals(d->vecFrames.size(), 0.0);
+	ph::TaskGroup tasks;
 	for (int j = 0; j < nTrials; j++)
-	{
-		// create the particle finder
-		ph::ImageProcessor imProcessor(d->vecFrames[(nHeights + 1) * j], s);
-		ph::ParticleFinder pFinder(&imProcessor, s, false);
 		for (int i = 0; i < nHeights; i++)
-		{
-			// find the particles
-			std::list<ph::Particle> listParticles = pFinder.findParticles(d->vecFrames[(nHeights + 1) * j + i + 1], true);
-			ssr += ((double)listParticles.front().getPositionReal().z - d->vecHeight[i]) * ((double)listParticles.front().getPositionReal().z - d->vecHeight[i]);
-		}
-	}
+			d->scheduler->submit(tasks, [d, param, j, i, nHeights, &vecResiduals]()
+				{
+					// update a copy of the settings with the passed parameters
+					ph::Settings s = *d->settings;
+					s.fEtaGlass = param[0];
+					s.fEtaLiquid = param[1];
+					s.fEtaParticle = param[2];
+					s.fChannelWallThickness = param[3];
+
+					// find the particle height, reusing the detected circles
+					int f = (nHeights + 1) * j + i + 1;
+					ph::ParticleFinder pFinder(&d->vecProcessors[j], &s, false);
+					std::list<ph::Particle> listParticles = pFinder.solveParticles(d->vecFrames[f], d->vecCircles[f]);
+					vecResiduals[f] = ((double)listParticles.front().getPositionReal().z - d->vecHeight[i]) * ((double)listParticles.front().getPositionReal().z - d->vecHeight[i]);
+				});
+	d->scheduler->wait(tasks);
+
+	// sum the residuals in frame order so the result doesn't depend on the scheduling
+	double ssr = 0;
+	for (double r : vecResiduals)
+		ssr += r;
+
+	// record the evaluation, starts running concurrently share the record
+	std::lock_guard<std::mutex> lock(d->mutexEvaluations);
+	d->vecEvaluatedParams.push_back(std::vector<double>(param, param + n));
+	d->vecEvaluatedSSR.push_back(ssr);
 
 	std::cout << "objective function called: eta_g = " << param[0]
 		<< ", eta_l = " << param[1] << ", eta_p = " << param[2]
@@ -515,7 +1165,113 @@ double calculateHeightResiduals(unsigned n, const double* param, double* grad, v
 	return ssr;
 }
 
-void calibrate(std::string& sVideoIn, std::vector<float> vecHeight, std::string& sSettings)
+double calibrateMultiStart(calibrateData& data, std::vector<double>& param)
+{
+	// each round runs nCalibrateStarts short Nelder-Mead searches concurrently, then fits a quadratic surrogate to the evaluations
+	// nearest the best point and evaluates its minimum. the best points found seed the next round with half the step. stops when
+	// a round improves the SSR by less than fCalibrateFtolAbs or the evaluation budget is spent
+	const ph::Settings* s = data.settings;
+	size_t nStarts = std::max(1, s->nCalibrateStarts);
+	std::vector<double> vecStep = {0.03, 0.03, 0.03, 0.03};
+
+	// spread the starts around the initial guess, with a fixed seed so the calibration is repeatable
+	std::vector<std::vector<double>> vecStarts = {param};
+	std::mt19937 rng(0);
+	std::uniform_real_distribution<double> offset(-2.0, 2.0);
+	while (vecStarts.size() < nStarts)
+	{
+		std::vector<double> start = param;
+		for (size_t k = 0; k < start.size(); ++k)
+			start[k] += offset(rng) * vecStep[k];
+		vecStarts.push_back(start);
+	}
+
+	double dBest = std::numeric_limits<double>::max();
+	for (int nRound = 1; ; ++nRound)
+	{
+		// run the starts concurrently, each objective call also splits its frames across the scheduler
+		std::vector<std::vector<double>> vecEnds(vecStarts);
+		std::vector<double> vecEndSSR(vecStarts.size(), std::numeric_limits<double>::max());
+		ph::TaskGroup tasks;
+		for (size_t i = 0; i < vecStarts.size(); ++i)
+			data.scheduler->submit(tasks, [&, i]()
+				{
+					nlopt::opt optimizer(nlopt::algorithm::LN_NELDERMEAD, 4);
+					optimizer.set_min_objective(calculateHeightResiduals, &data);
+					optimizer.set_initial_step(vecStep);
+					optimizer.set_ftol_abs(s->fCalibrateFtolAbs);
+					optimizer.set_maxeval(s->nCalibrateRoundEvals);
+					try
+					{
+						optimizer.optimize(vecEnds[i], vecEndSSR[i]);
+					}
+					catch (std::exception& e)
+					{
+						std::cout << "NLopt start " << i << " failed: " << e.what() << std::endl;
+					}
+				});
+		data.scheduler->wait(tasks);
+
+		// the surrogate is fitted around the best evaluation so far, using the evaluations nearest to it
+		std::vector<std::vector<double>> vecPoints = data.vecEvaluatedParams;
+		std::vector<double> vecSSR = data.vecEvaluatedSSR;
+		size_t iBest = std::min_element(vecSSR.begin(), vecSSR.end()) - vecSSR.begin();
+		std::vector<double> vecDist(vecPoints.size(), 0.0);
+		for (size_t i = 0; i < vecPoints.size(); ++i)
+			for (size_t k = 0; k < vecStep.size(); ++k)
+				vecDist[i] += (vecPoints[i][k] - vecPoints[iBest][k]) * (vecPoints[i][k] - vecPoints[iBest][k]) / (vecStep[k] * vecStep[k]);
+		std::vector<size_t> vecOrder(vecPoints.size());
+		std::iota(vecOrder.begin(), vecOrder.end(), 0);
+		std::sort(vecOrder.begin(), vecOrder.end(), [&](size_t a, size_t b) { return vecDist[a] < vecDist[b]; });
+		vecOrder.resize(std::min(vecOrder.size(), 2 * ph::QuadraticSurrogate::getNumTerms(vecStep.size())));
+
+		std::vector<std::vector<double>> vecNearPoints;
+		std::vector<double> vecNearSSR;
+		for (size_t i : vecOrder)
+		{
+			vecNearPoints.push_back(vecPoints[i]);
+			vecNearSSR.push_back(vecSSR[i]);
+		}
+
+		ph::QuadraticSurrogate surrogate(vecPoints[iBest], vecStep);
+		if (surrogate.fit(vecNearPoints, vecNearSSR))
+		{
+			// trust the model within two steps of the best point
+			std::vector<double> vecCandidate = surrogate.getMinimum(2.0);
+			std::cout << "surrogate predicts SSR " << surrogate.predict(vecCandidate) << std::endl;
+			vecEnds.push_back(vecCandidate);
+			vecEndSSR.push_back(calculateHeightResiduals(4, vecCandidate.data(), nullptr, &data));
+		}
+
+		// the best evaluation of the round includes the surrogate's candidate
+		size_t iRoundBest = std::min_element(vecEndSSR.begin(), vecEndSSR.end()) - vecEndSSR.begin();
+		double dImprovement = dBest - vecEndSSR[iRoundBest];
+		if (dImprovement > 0)
+		{
+			dBest = vecEndSSR[iRoundBest];
+			param = vecEnds[iRoundBest];
+		}
+
+		size_t nEvals = data.vecEvaluatedSSR.size();
+		std::cout << "calibration round " << nRound << ": best SSR " << dBest << " after " << nEvals << " evaluations" << std::endl;
+		if (dImprovement < s->fCalibrateFtolAbs || (int)nEvals >= s->nCalibrateMaxEvals)
+			break;
+
+		// the best points of the round start the next one
+		vecOrder.resize(vecEnds.size());
+		std::iota(vecOrder.begin(), vecOrder.end(), 0);
+		std::sort(vecOrder.begin(), vecOrder.end(), [&](size_t a, size_t b) { return vecEndSSR[a] < vecEndSSR[b]; });
+		vecStarts.clear();
+		for (size_t i = 0; i < std::min(nStarts, vecOrder.size()); ++i)
+			vecStarts.push_back(vecEnds[vecOrder[i]]);
+		for (double& step : vecStep)
+			step *= 0.5;
+	}
+
+	return dBest;
+}
+
+void calibrate(std::string& sVideoIn, std::vector<float> vecHeight, std::string& sSettings, int nThreads)
 {
 	// calibration video should have n * (len(vecHeight) + 1) frames where n is the integral number of calibration trials. 
 	// each (n + 1)th frame should be a reference image and the subsequent frames should be the particle images corresponding
@@ -534,9 +1290,15 @@ void calibrate(std::string& sVideoIn, std::vector<float> vecHeight, std::string&
 	}
 	ph::Particle::setSettings(&settings);
 
+	// the objective function solves the calibration frames concurrently
+	ph::ThreadBudget::configure(nThreads, true);
+	ph::ThreadBudget::printSummary(std::cout);
+	ph::TaskScheduler scheduler(ph::ThreadBudget::getWorkerThreads());
+
 	// load in the video frames
-	cv::VideoCapture cap(sVideoIn);  // create video capture object
+	ph::FrameSource cap(sVideoIn);  // open the video as grayscale frames
 	if (!cap.isOpened()) error("unable to open video");
+	if (cap.isAligned()) error("calibration frames are aligned to each trial's ref image, convert the calibration video without aligning it");
 	std::vector<cv::Mat> vecFrames;
 	ph::ImageProcessor imProcessor;
 	imProcessor.setSettings(&settings);
@@ -545,9 +1307,11 @@ void calibrate(std::string& sVideoIn, std::vector<float> vecHeight, std::string&
 	{
 		cv::Mat matFrame;
 		cap >> matFrame;  // store the next available frame
-		if (matFrame.empty()) break;  // check for video end
-
-		cv::cvtColor(matFrame, matFrame, cv::COLOR_BGR2GRAY);  // convert to grayscale
+		if (matFrame.empty())
+		{
+			if (cap.isDamaged()) error(("frame " + std::to_string(n) + " of the video can't be read").c_str());
+			break;  // check for video end
+		}
 
 		// check if the frame is a reference image or not
 		if (n % (vecHeight.size() + 1) == 0)
@@ -566,14 +1330,23 @@ void calibrate(std::string& sVideoIn, std::vector<float> vecHeight, std::string&
 	}
 
 	// create the data object for the optimizer
-	calibrateData data = { &settings, vecFrames, vecHeight };
+	calibrateData data = { &settings, &scheduler, vecFrames, vecHeight };
 
-	// set up NLopt optimizer
-	nlopt::opt optimizer(nlopt::algorithm::LN_NELDERMEAD, 4);
-	optimizer.set_min_objective(calculateHeightResiduals, &data);
-	std::vector<double> vecInitialStep = {0.03, 0.03, 0.03, 0.03};
-	optimizer.set_initial_step(vecInitialStep);
-	optimizer.set_ftol_abs(0.0001); // TODO: find a good convergence condition here
+	// detect the particles in each frame once, only their heights need to be found again when the optical parameters change
+	int nHeights = vecHeight.size();
+	data.vecCircles.resize(vecFrames.size());
+	for (size_t j = 0; j < vecFrames.size() / (nHeights + 1); j++)
+	{
+		data.vecProcessors.push_back(ph::ImageProcessor(vecFrames[(nHeights + 1) * j], &settings));
+		ph::ParticleFinder pFinder(&data.vecProcessors.back(), &settings, false);
+		for (int i = 0; i < nHeights; i++)
+		{
+			int f = (nHeights + 1) * j + i + 1;
+			data.vecCircles[f] = pFinder.detectParticles(vecFrames[f], true);
+			if (data.vecCircles[f].empty())
+				error(("no particle found in calibration frame " + std::to_string(f)).c_str());
+		}
+	}
 
 	// get the initial guess for the parameters from the loaded settings
 	std::vector<double> param = {settings.fEtaGlass, settings.fEtaLiquid, settings.fEtaParticle, settings.fChannelWallThickness};
@@ -581,11 +1354,23 @@ void calibrate(std::string& sVideoIn, std::vector<float> vecHeight, std::string&
 	// perform the calibration
 	try
 	{
-		// perform optimization
 		double ssr;
-		optimizer.optimize(param /* initial guess */, ssr /* final f value */);
+		if (settings.nCalibrateMode == ph::Settings::CALIBRATE_MULTISTART)
+			ssr = calibrateMultiStart(data, param);
+		else
+		{
+			// set up NLopt optimizer
+			nlopt::opt optimizer(nlopt::algorithm::LN_NELDERMEAD, 4);
+			optimizer.set_min_objective(calculateHeightResiduals, &data);
+			std::vector<double> vecInitialStep = {0.03, 0.03, 0.03, 0.03};
+			optimizer.set_initial_step(vecInitialStep);
+			optimizer.set_ftol_abs(settings.fCalibrateFtolAbs);
+
+			// perform optimization
+			optimizer.optimize(param /* initial guess */, ssr /* final f value */);
+		}
 
-		std::cout << "calibration completed with SSR " << ssr << "\n"
+		std::cout << "calibration completed with SSR " << ssr << " after " << data.vecEvaluatedSSR.size() << " evaluations\n"
 			<< "eta glass: " << param[0] << "\n"
 			<< "eta liquid: " << param[1] << "\n"
 			<< "eta particle: " << param[2] << "\n"
@@ -614,16 +1399,317 @@ void calibrate(std::string& sVideoIn, std::vector<float> vecHeight, std::string&
 	}
 }
 
+void convertVideo(std::string& sVideoIn, std::string& sRefVid, std::string& sStackOut, bool bAlign, int nThreads)
+{
+	// decode the video once into a frame stack with the ref image as the first frame, optionally aligning the rest to it
+	// the frames are aligned one at a time so opencv gets all the threads
+	auto startTime = std::chrono::high_resolution_clock::now();
+	ph::ThreadBudget::configure(nThreads, false);
+
+	ph::FrameSource cap(sVideoIn);  // open the video as grayscale frames
+	if (!cap.isOpened()) error("unable to open video");
+	if (cap.isAligned()) error("video is already an aligned frame stack");
+
+	// read the ref image
+	cv::Mat matRef;
+	if (sRefVid == "")
+	{
+		// separate ref video not provided so the ref image should be the first frame
+		cap >> matRef;
+	}
+	else
+	{
+		// get the reference image from the provided reference video
+		ph::FrameSource capRef(sRefVid);
+		if (!capRef.isOpened()) error("unable to open reference video");
+		capRef >> matRef;
+		capRef.release();  // clean up the capture object
+	}
+	if (matRef.empty()) error("no reference image");
+
+	ph::FrameStackWriter stackWriter;
+	if (!stackWriter.open(sStackOut, matRef.size(), bAlign)) error("unable to open output frame stack");
+	stackWriter.write(matRef);
+
+	// alignment doesn't use any settings
+	ph::ImageProcessor imProcessor(matRef, nullptr);
+	int n = 1;
+	while (true)
+	{
+		cv::Mat matFrame;
+		cap >> matFrame;  // store the next available frame
+		if (matFrame.empty())
+		{
+			if (cap.isDamaged()) error(("frame " + std::to_string(n) + " of the video can't be read").c_str());
+			break;  // check for video end
+		}
+
+		bool bWritten;
+		if (bAlign)
+		{
+			// store the frame aligned to the ref image along with its warp
+			cv::Mat matWarp;
+			double dAlignment = imProcessor.alignToRef(matFrame, matWarp);
+			std::cout << "aligned frame " << n << " with correlation coefficient " << dAlignment << "\r";
+			bWritten = stackWriter.write(matFrame, matWarp, dAlignment);
+		}
+		else
+			bWritten = stackWriter.write(matFrame);
+		if (!bWritten) error(("failed to write frame " + std::to_string(n) + ", frames must match the size of the ref image").c_str());
+
+		n++;
+	}
+	if (!stackWriter.close()) error("failed to write frame stack");
+
+	auto endTime = std::chrono::high_resolution_clock::now();
+	double dSeconds = std::chrono::duration_cast<std::chrono::milliseconds>(endTime - startTime).count() / 1000.0;
+	std::cout << std::endl << "wrote " << n << " frames to " << sStackOut << " in " << dSeconds << " s" << std::endl;
+}
+
+void generateVideo(std::string& sRefVid, std::string& sPositions, std::string& sVideoOut, std::string& sTruthOut, std::string& sSettings, int nThreads)
+{
+	// render a synthetic video of particles at known positions over a ref image, for accuracy and throughput benchmarks
+	// the positions are read from a csv in the output layout (frame,x,y,z) or are random particles that wander between frames,
+	// the ref image is the first frame of the output and the positions rendered are written to sTruthOut
+	auto startTime = std::chrono::high_resolution_clock::now();
+
+	ph::FrameSource capRef(sRefVid);
+	if (!capRef.isOpened()) error("unable to open reference video");
+	cv::Mat matRef;
+	capRef >> matRef;
+	if (matRef.empty()) error("no reference image");
+	capRef.release();
+
+	// load settings from file
+	ph::Settings settings;
+	if (sSettings != "")
+	{
+		settings.setFile(sSettings.c_str());
+		int l = settings.load();
+		if (l < 0)
+			std::cout << "failed to open settings file, using defaults" << std::endl;
+		else
+			std::cout << "opened settings file, loaded " << l << " setting values" << std::endl;
+	}
+
+	// positions of each frame in the coordinate system in the paper
+	std::vector<std::vector<ph::vf3>> vecFrames;
+	if (sPositions != "")
+	{
+		std::ifstream positionsFile(sPositions);
+		if (!positionsFile.is_open()) error("unable to open positions file");
+		std::string sLine;
+		while (std::getline(positionsFile, sLine))
+		{
+			int nFrame;
+			float x, y, z;
+			if (sscanf_s(sLine.c_str(), "%d,%f,%f,%f", &nFrame, &x, &y, &z) != 4 || nFrame < 1)
+				continue;  // header
+			if ((int)vecFrames.size() < nFrame)
+				vecFrames.resize(nFrame);
+			vecFrames[nFrame - 1].push_back(ph::vf3(x, y, z));
+		}
+	}
+	else
+	{
+		// random particles that don't intersect, each frame they take a random step unless it would make them intersect
+		float r = settings.fParticleRadiusPx / settings.fPxPerMM;
+		ph::vf3 vMin(r, r, r);
+		ph::vf3 vMax(matRef.rows / settings.fPxPerMM - r, settings.fChannelHeight - r, matRef.cols / settings.fPxPerMM - r);
+		std::mt19937 rng(settings.nGenerateSeed);
+		std::uniform_real_distribution<float> uniform(0, 1);
+		std::normal_distribution<float> step(0, settings.fGenerateStep);
+		auto intersects = [&](const std::vector<ph::vf3>& vecPositions, const ph::vf3& v, size_t nSkip)
+		{
+			for (size_t i = 0; i < vecPositions.size(); i++)
+				if (i != nSkip && (vecPositions[i] - v).square() < 4 * r * r)
+					return true;
+			return false;
+		};
+		auto reflect = [](float f, float fMin, float fMax) { return (f < fMin) ? 2 * fMin - f : ((f > fMax) ? 2 * fMax - f : f); };
+
+		std::vector<ph::vf3> vecPositions;
+		for (int nTry = 0; nTry < 1000 * settings.nGenerateParticles && (int)vecPositions.size() < settings.nGenerateParticles; nTry++)
+		{
+			ph::vf3 v(vMin.x + uniform(rng) * (vMax.x - vMin.x), vMin.y + uniform(rng) * (vMax.y - vMin.y), vMin.z + uniform(rng) * (vMax.z - vMin.z));
+			if (!intersects(vecPositions, v, vecPositions.size()))
+				vecPositions.push_back(v);
+		}
+		if ((int)vecPositions.size() < settings.nGenerateParticles)
+			std::cout << "only " << vecPositions.size() << " particles fit in the channel" << std::endl;
+
+		for (int n = 0; n < settings.nGenerateFrames; n++)
+		{
+			if (n > 0)
+				for (size_t i = 0; i < vecPositions.size(); i++)
+				{
+					ph::vf3 v = vecPositions[i] + ph::vf3(step(rng), step(rng), step(rng));
+					v = ph::vf3(reflect(v.x, vMin.x, vMax.x), reflect(v.y, vMin.y, vMax.y), reflect(v.z, vMin.z, vMax.z));
+					if (!intersects(vecPositions, v, i))
+						vecPositions[i] = v;
+				}
+			vecFrames.push_back(vecPositions);
+		}
+	}
+	if (vecFrames.empty()) error("no particle positions");
+
+	// write the ground truth, particles keep their index in each frame
+	std::ofstream truthFile(sTruthOut);
+	if (!truthFile.is_open()) error("could not open ground truth file");
+	truthFile << "frame,x,y,z,particle\n";
+	for (size_t n = 0; n < vecFrames.size(); n++)
+		for (size_t i = 0; i < vecFrames[n].size(); i++)
+			truthFile << n + 1 << "," << vecFrames[n][i].x << "," << vecFrames[n][i].y << "," << vecFrames[n][i].z << "," << i << "\n";
+	truthFile.close();
+
+	// the output is a frame stack or an uncompressed 8-bit avi, both read without decoding
+	bool bStack = (getExt(sVideoOut.c_str()) == "phs");
+	ph::FrameStackWriter stackWriter;
+	cv::VideoWriter writer;
+	if (bStack ? !stackWriter.open(sVideoOut, matRef.size(), false) : !writer.open(sVideoOut, cv::VideoWriter::fourcc('Y', '8', '0', '0'), 30.0, matRef.size(), false))
+		error("unable to open output video");
+	auto writeFrame = [&](const cv::Mat& matFrame)
+	{
+		if (bStack)
+			stackWriter.write(matFrame);
+		else
+			writer.write(matFrame);
+	};
+	writeFrame(matRef);
+
+	// frames are rendered as parallel tasks and written in order
+	ph::ThreadBudget::configure(nThreads, true);
+	ph::ThreadBudget::printSummary(std::cout);
+	ph::TaskScheduler scheduler(ph::ThreadBudget::getWorkerThreads());
+	ph::FrameRenderer renderer(matRef, &settings);
+	size_t nMaxFramesInFlight = 2 * scheduler.getNumThreads();
+	std::deque<std::pair<cv::Mat, ph::TaskGroup>> queueFrames;
+	auto writeOldestFrame = [&]()
+	{
+		try
+		{
+			scheduler.wait(queueFrames.front().second);
+		}
+		catch (...)
+		{
+			// the other frames in flight render into the queue, let them finish before passing the failure on
+			for (auto& frame : queueFrames)
+				try { scheduler.wait(frame.second); } catch (...) {}
+			throw;
+		}
+		writeFrame(queueFrames.front().first);
+		queueFrames.pop_front();
+	};
+	for (size_t n = 0; n < vecFrames.size(); n++)
+	{
+		if (queueFrames.size() >= nMaxFramesInFlight)
+			writeOldestFrame();
+
+		queueFrames.emplace_back();
+		cv::Mat* pFrame = &queueFrames.back().first;
+		const std::vector<ph::vf3>* pPositions = &vecFrames[n];
+		scheduler.submit(queueFrames.back().second, [&, pFrame, pPositions]()
+			{
+				// convert to channel coordinates
+				std::vector<ph::vf3> vecReal;
+				for (auto& v : *pPositions)
+					vecReal.push_back(ph::vf3(v.z, v.x, v.y + settings.fChannelWallThickness));
+				renderer.render(vecReal, *pFrame);
+			}, std::numeric_limits<float>::max());
+	}
+	while (!queueFrames.empty())
+		writeOldestFrame();
+	if (bStack && !stackWriter.close()) error("failed to write frame stack");
+
+	auto endTime = std::chrono::high_resolution_clock::now();
+	double dSeconds = std::chrono::duration_cast<std::chrono::milliseconds>(endTime - startTime).count() / 1000.0;
+	std::cout << "rendered " << vecFrames.size() << " frames to " << sVideoOut << " in " << dSeconds << " s" << std::endl;
+}
+
+void exportResults(std::string& sResultsIn, std::string& sOutput, std::string& sSettingsPath)
+{
+	// write a binary results file in the csv layout of the processing mode, linking the trajectories if the settings ask for it
+	ph::ResultReader resultReader;
+	if (!resultReader.open(sResultsIn)) error("unable to open results file");
+
+	ph::Settings settings;
+	if (sSettingsPath != "")
+	{
+		settings.setFile(sSettingsPath.c_str());
+		int l = settings.load();
+		if (l < 0)
+			std::cout << "failed to open settings file, using defaults" << std::endl;
+		else
+			std::cout << "opened settings file, loaded " << l << " setting values" << std::endl;
+	}
+	ph::TrajectoryLinker linker(settings.fLinkMaxDisplacement, settings.nLinkMaxSubnetSize);
+
+	std::ofstream outputFile(sOutput);
+	if (!outputFile.is_open()) error("could not open output file");
+	outputFile << (settings.bLinkTrajectories ? "frame,x,y,z,confidence,particle\n" : "frame,x,y,z,confidence\n");
+
+	std::vector<ph::ResultRow> vecRows;
+	for (size_t i = 0; i < resultReader.getFrameCount(); i++)
+	{
+		if (!resultReader.readFrame(i, vecRows)) error("results file is truncated");
+		int nFrame = resultReader.getFrameIndex(i).nFrame;
+
+		std::vector<int> vecIds;
+		if (settings.bLinkTrajectories)
+		{
+			std::vector<ph::vf3> vecPositions;
+			for (auto& r : vecRows)
+				vecPositions.push_back(ph::vf3(r.x, r.y, r.z));
+			vecIds = linker.link(vecPositions);
+		}
+
+		for (size_t j = 0; j < vecRows.size(); j++)
+		{
+			const ph::ResultRow& r = vecRows[j];
+			outputFile << nFrame << "," << r.x << "," << r.y << "," << r.z << "," << r.fConfidence;
+			if (settings.bLinkTrajectories)
+				outputFile << "," << vecIds[j];
+			outputFile << "\n";
+		}
+	}
+
+	std::cout << "exported " << resultReader.getFrameCount() << " frames to " << sOutput << std::endl;
+}
+
+void exportMasks(std::string& sMasksIn, std::string& sVideoOut)
+{
+	// write a mask file as the debug video of the processing mode, for viewing
+	ph::MaskReader maskReader;
+	if (!maskReader.open(sMasksIn)) error("unable to open mask file");
+
+	cv::VideoWriter writer;
+	writer.open(sVideoOut, cv::VideoWriter::fourcc('M', 'J', 'P', 'G'), 30.0, maskReader.getSize());
+	if (!writer.isOpened()) error("unable to open output video writer");
+
+	cv::Mat matMask, matFrame;
+	for (size_t i = 0; i < maskReader.getFrameCount(); i++)
+	{
+		if (!maskReader.readFrame(i, matMask)) error("mask file is truncated");
+		cv::cvtColor(matMask, matFrame, cv::COLOR_GRAY2RGB);
+		writer.write(matFrame);
+	}
+
+	std::cout << "exported " << maskReader.getFrameCount() << " masks to " << sVideoOut << std::endl;
+}
+
 int main(int argc, char** argv)
 {
 	// parse command line input
 	if (argc < 3) usage();
 	
-	enum Mode {PROCESS, CALIBRATE, SETUP} mode;
+	enum Mode {PROCESS, CALIBRATE, SETUP, CONVERT, EXPORT, GENERATE} mode;
 	if (std::string(argv[1]) == "-h" || std::string(argv[1]) == "-help") usage();
 	else if (std::string(argv[1]) == "-p" || std::string(argv[1]) == "-process") mode = PROCESS;
 	else if (std::string(argv[1]) == "-c" || std::string(argv[1]) == "-calibrate") mode = CALIBRATE;
 	else if (std::string(argv[1]) == "-s" || std::string(argv[1]) == "-setup") mode = SETUP;
+	else if (std::string(argv[1]) == "-x" || std::string(argv[1]) == "-convert") mode = CONVERT;
+	else if (std::string(argv[1]) == "-e" || std::string(argv[1]) == "-export") mode = EXPORT;
+	else if (std::string(argv[1]) == "-g" || std::string(argv[1]) == "-generate") mode = GENERATE;
 	else error("unrecognized mode flag");
 
 	std::string sVideoInPath = "";
@@ -631,25 +1717,105 @@ int main(int argc, char** argv)
 	std::string sSettingsPath = "";
 	std::string sOutPath = "";
 	std::string sVideoOutPath = "";
+	std::string sStackOutPath = "";
+	std::string sResultsPath = "";
+	std::string sStatsPath = "";
+	std::string sMaskPath = "";
+	std::string sPositionsPath = "";
+	std::string sMetricsPath = "";
+	std::string sTracePath = "";
 	bool bRefVid = false;
+	bool bAlign = false;
+	bool bBatch = false;
+	runOptions options;
 	int nSetupFrames = 10;
+	int nThreads = 0;
 	float fKnownHeight;
 	std::vector<float> vecKnownHeights;
 
 	for (int i = 2; i < argc; i++)
 	{
 		char* arg = argv[i];
-		if (mode == SETUP && sscanf_s(arg, "%d", &nSetupFrames) == 1) { /* number of frames to load for setup */ }
+		if (std::string(arg) == "-t" || std::string(arg) == "-threads")
+		{
+			// number of threads to use
+			if (++i >= argc || sscanf_s(argv[i], "%d", &nThreads) != 1) error("number of threads expected after -t");
+		}
+		else if (mode == PROCESS && (std::string(arg) == "-o" || std::string(arg) == "-statistics"))
+		{
+			// flow statistics file
+			if (++i >= argc) error("statistics file expected after -o");
+			sStatsPath = std::string(argv[i]);
+		}
+		else if (mode == PROCESS && (std::string(arg) == "-m" || std::string(arg) == "-metrics"))
+		{
+			// per frame metrics file
+			if (++i >= argc) error("metrics file expected after -m");
+			sMetricsPath = std::string(argv[i]);
+		}
+		else if (mode == PROCESS && (std::string(arg) == "-j" || std::string(arg) == "-trace"))
+		{
+			// chrome trace event file of the work on every thread
+			if (++i >= argc) error("trace file expected after -j");
+			sTracePath = std::string(argv[i]);
+		}
+		else if (mode == SETUP && sscanf_s(arg, "%d", &nSetupFrames) == 1) { /* number of frames to load for setup */ }
 		else if (mode == CALIBRATE && sscanf_s(arg, "%f", &fKnownHeight) == 1)
 			vecKnownHeights.push_back(fKnownHeight);
-		else if ((mode == SETUP || mode == PROCESS) && (std::string(arg) == "-r" || std::string(arg) == "-ref"))
+		else if ((mode == SETUP || mode == PROCESS || mode == CONVERT) && (std::string(arg) == "-r" || std::string(arg) == "-ref"))
 			bRefVid = true;
-		else if (sVideoInPath == "" && getExt(arg) == "avi")
+		else if (mode == PROCESS && (std::string(arg) == "-u" || std::string(arg) == "-resume"))
+			options.bResume = true;
+		else if (mode == PROCESS && (std::string(arg) == "-i" || std::string(arg) == "-roi"))
+		{
+			// region of interest in pixels, or in mm with an mm suffix
+			if (++i >= argc || sscanf_s(argv[i], "%f,%f,%f,%f", &options.rectROI.x, &options.rectROI.y, &options.rectROI.width, &options.rectROI.height) != 4
+				|| options.rectROI.width <= 0 || options.rectROI.height <= 0)
+				error("region x,y,width,height expected after -i");
+			std::string sROI(argv[i]);
+			options.bROIInMM = (sROI.size() > 2 && sROI.substr(sROI.size() - 2) == "mm");
+		}
+		else if (mode == PROCESS && (std::string(arg) == "-f" || std::string(arg) == "-frames"))
+		{
+			// first frame and optionally the last one
+			if (++i >= argc || sscanf_s(argv[i], "%d:%d", &options.nFirstFrame, &options.nLastFrame) < 1 || options.nFirstFrame < 1
+				|| (options.nLastFrame != 0 && options.nLastFrame < options.nFirstFrame))
+				error("frame range first[:last] expected after -f");
+		}
+		else if (mode == PROCESS && (std::string(arg) == "-k" || std::string(arg) == "-stride"))
+		{
+			// process every k-th frame
+			if (++i >= argc || sscanf_s(argv[i], "%d", &options.nStride) != 1 || options.nStride < 1)
+				error("frame stride expected after -k");
+		}
+		else if (mode == CONVERT && (std::string(arg) == "-a" || std::string(arg) == "-align"))
+			bAlign = true;
+		else if (mode == PROCESS && sVideoInPath == "" && isDirectory(arg))
+		{
+			// batch of videos
 			sVideoInPath = std::string(arg);
-		else if (sRefVid == "" && getExt(arg) == "avi" && bRefVid)
+			bBatch = true;
+		}
+		else if (mode == EXPORT && sVideoOutPath == "" && getExt(arg) == "avi")
+			sVideoOutPath = std::string(arg);
+		else if (sVideoInPath == "" && isVideoExt(getExt(arg)))
+			sVideoInPath = std::string(arg);
+		else if ((mode == CONVERT || mode == GENERATE) && sStackOutPath == "" && getExt(arg) == "phs")
+			sStackOutPath = std::string(arg);
+		else if (sRefVid == "" && isVideoExt(getExt(arg)) && bRefVid)
 			sRefVid = std::string(arg);
 		else if (sSettingsPath == "" && getExt(arg) == "txt")
 			sSettingsPath = std::string(arg);
+		else if ((mode == PROCESS || mode == EXPORT) && sResultsPath == "" && getExt(arg) == "phr")
+			sResultsPath = std::string(arg);
+		else if ((mode == PROCESS || mode == EXPORT) && sMaskPath == "" && getExt(arg) == "phm")
+			sMaskPath = std::string(arg);
+		else if (mode == GENERATE && sOutPath != "" && sPositionsPath == "" && getExt(arg) == "csv")
+		{
+			// with two csv files the first holds the positions
+			sPositionsPath = sOutPath;
+			sOutPath = std::string(arg);
+		}
 		else if (sOutPath == "" && getExt(arg) == "csv")
 			sOutPath = std::string(arg);
 		else if (sVideoInPath != "" && getExt(arg) == "avi")
@@ -658,7 +1824,7 @@ int main(int argc, char** argv)
 			error("unrecognized argument");
 	}
 
-	if (sVideoInPath == "") error("no video file");
+	if (sVideoInPath == "" && mode != EXPORT) error("no video file");
 	if (bRefVid && sRefVid == "") error("no reference video");
 
 	switch (mode)
@@ -666,20 +1832,59 @@ int main(int argc, char** argv)
 	case PROCESS:
 	{
 		// process all frames of the video
-		if (sOutPath == "" && sVideoOutPath == "") error("output file path required in process mode");
-		processVideo(sVideoInPath, sRefVid, sVideoOutPath, sOutPath, sSettingsPath);
+		if (sOutPath == "" && sVideoOutPath == "" && sResultsPath == "" && sStatsPath == "" && sMaskPath == "") error("output file path required in process mode");
+		videoJob video = { sVideoInPath, sVideoOutPath, sOutPath, sResultsPath, sStatsPath, sMaskPath, sMetricsPath, 0, 0 };
+		if (sTracePath != "")
+			ph::TraceRecorder::start();
+		if (bBatch)
+		{
+			// the given outputs only select which files are written for each video
+			if (bRefVid) error("videos in a batch use the \"ref\" video in their directory");
+			processBatch(sVideoInPath, video, sSettingsPath, nThreads, options);
+		}
+		else
+			processVideo(video, sRefVid, sSettingsPath, nThreads, options);
+		if (sTracePath != "" && !ph::TraceRecorder::stop(sTracePath))
+			error("failed to write trace file");
 		break;
 	}
 	case CALIBRATE:
 	{
 		// calibrate optical parameters with known height particle video
-		calibrate(sVideoInPath, vecKnownHeights, sSettingsPath);
+		calibrate(sVideoInPath, vecKnownHeights, sSettingsPath, nThreads);
 		break;
 	}
 	case SETUP:
 	{
 		// interactively configure the image processing settings
-		configureSettings(sVideoInPath, sRefVid, nSetupFrames, sSettingsPath);
+		configureSettings(sVideoInPath, sRefVid, nSetupFrames, sSettingsPath, nThreads);
+		break;
+	}
+	case CONVERT:
+	{
+		// decode the video into a frame stack
+		if (sStackOutPath == "") error("output frame stack (.phs) required in convert mode");
+		convertVideo(sVideoInPath, sRefVid, sStackOutPath, bAlign, nThreads);
+		break;
+	}
+	case GENERATE:
+	{
+		// render a synthetic video over the ref image of the given video
+		if (sStackOutPath != "" && sVideoOutPath != "") error("only one output video allowed in generate mode");
+		if (sStackOutPath != "") sVideoOutPath = sStackOutPath;
+		if (sVideoOutPath == "" || sOutPath == "") error("output video (.avi or .phs) and ground truth csv required in generate mode");
+		generateVideo(sVideoInPath, sPositionsPath, sVideoOutPath, sOutPath, sSettingsPath, nThreads);
+		break;
+	}
+	case EXPORT:
+	{
+		// convert binary results to csv and masks to a video
+		if ((sResultsPath == "" || sOutPath == "") && (sMaskPath == "" || sVideoOutPath == ""))
+			error("results file (.phr) and output csv, or mask file (.phm) and output video, required in export mode");
+		if (sResultsPath != "" && sOutPath != "")
+			exportResults(sResultsPath, sOutPath, sSettingsPath);
+		if (sMaskPath != "" && sVideoOutPath != "")
+			exportMasks(sMaskPath, sVideoOutPath);
 		break;
 	}
 	}
@@ -0,0 +1,123 @@
+#include "ResultFile.h"
+#include <cstring>
+
+using namespace ph;
+
+namespace
+{
+	template<class T>
+	void append(std::vector<char>& vecBlock, const T& value)
+	{
+		const char* p = (const char*)&value;
+		vecBlock.insert(vecBlock.end(), p, p + sizeof(T));
+	}
+}
+
+bool ph::ResultWriter::open(const std::string& file, const Settings* s)
+{
+	close();
+	if (!m_writer.open(file))
+		return false;
+
+	ResultFileHeader header = { {'P', 'H', 'R', 'S'}, nVersion, nColumns, 0 };
+	m_writer.write(&header, sizeof(header));
+	m_fWallThickness = s->fChannelWallThickness;
+	m_vecIndex.clear();
+	return true;
+}
+
+bool ph::ResultWriter::resume(const std::string& file, const Settings* s, uint64_t nOffset, const std::vector<ResultFrameIndex>& vecIndex)
+{
+	// continue a file from a sync, dropping the blocks written after it and the index if the file was closed
+	close();
+	{
+		ResultFileHeader header;
+		std::ifstream inFile(file, std::ios::binary);
+		if (!inFile.read((char*)&header, sizeof(header)) || std::memcmp(header.magic, "PHRS", 4) != 0
+			|| header.nVersion != nVersion || header.nColumns != nColumns)
+			return false;
+	}
+	if (nOffset < sizeof(ResultFileHeader) || !m_writer.resume(file, nOffset))
+		return false;
+
+	m_fWallThickness = s->fChannelWallThickness;
+	m_vecIndex = vecIndex;
+	return true;
+}
+
+void ph::ResultWriter::write(int nFrame, const std::list<Particle>& listParticles)
+{
+	// encode the frame's block
+	uint32_t nParticles = (uint32_t)listParticles.size();
+	std::vector<char> vecBlock;
+	vecBlock.reserve(2 * sizeof(uint32_t) + nParticles * nColumns * 4);
+	append(vecBlock, (uint32_t)nFrame);
+	append(vecBlock, nParticles);
+
+	// convert to the coordinate system in the paper
+	for (auto& p : listParticles) append(vecBlock, p.getPositionReal().y);
+	for (auto& p : listParticles) append(vecBlock, p.getPositionReal().z - m_fWallThickness);
+	for (auto& p : listParticles) append(vecBlock, p.getPositionReal().x);
+	for (auto& p : listParticles) append(vecBlock, p.getConfidence());
+	for (auto& p : listParticles) append(vecBlock, (int32_t)p.getGroup());
+	for (auto& p : listParticles) append(vecBlock, (uint32_t)p.getEvals());
+
+	m_vecIndex.push_back({ (uint32_t)nFrame, nParticles, m_writer.getOffset() });
+	m_writer.write(std::move(vecBlock));
+}
+
+bool ph::ResultWriter::close()
+{
+	if (!m_writer.isOpened())
+		return false;
+
+	// append the index and the trailer after the blocks
+	ResultFileTrailer trailer = { m_writer.getOffset(), m_vecIndex.size(), {'P', 'H', 'R', 'I'}, 0 };
+	m_writer.write(m_vecIndex.data(), m_vecIndex.size() * sizeof(ResultFrameIndex));
+	m_writer.write(&trailer, sizeof(trailer));
+	return m_writer.close();
+}
+
+bool ph::ResultReader::open(const std::string& file)
+{
+	m_file.open(file, std::ios::binary);
+	if (!m_file.is_open())
+		return false;
+
+	// check the header, then find the index through the trailer
+	ResultFileHeader header;
+	ResultFileTrailer trailer;
+	if (!m_file.read((char*)&header, sizeof(header)) || std::memcmp(header.magic, "PHRS", 4) != 0
+		|| header.nVersion != ResultWriter::nVersion || header.nColumns != ResultWriter::nColumns)
+		return false;
+	m_file.seekg(-(std::streamoff)sizeof(trailer), std::ios::end);
+	if (!m_file.read((char*)&trailer, sizeof(trailer)) || std::memcmp(trailer.magic, "PHRI", 4) != 0)
+		return false;
+
+	m_vecIndex.resize(trailer.nFrames);
+	m_file.seekg(trailer.nIndexOffset);
+	return (bool)m_file.read((char*)m_vecIndex.data(), m_vecIndex.size() * sizeof(ResultFrameIndex));
+}
+
+bool ph::ResultReader::readFrame(size_t i, std::vector<ResultRow>& vecRows)
+{
+	uint32_t n = m_vecIndex[i].nParticles;
+	m_vecBlock.resize(2 * sizeof(uint32_t) + n * ResultWriter::nColumns * 4);
+	m_file.seekg(m_vecIndex[i].nOffset);
+	if (!m_file.read(m_vecBlock.data(), m_vecBlock.size()))
+		return false;
+
+	// gather the columns into rows
+	vecRows.resize(n);
+	const char* pColumn = m_vecBlock.data() + 2 * sizeof(uint32_t);
+	for (uint32_t j = 0; j < n; j++)
+	{
+		std::memcpy(&vecRows[j].x, pColumn + 4 * j, 4);
+		std::memcpy(&vecRows[j].y, pColumn + 4 * (n + j), 4);
+		std::memcpy(&vecRows[j].z, pColumn + 4 * (2 * n + j), 4);
+		std::memcpy(&vecRows[j].fConfidence, pColumn + 4 * (3 * n + j), 4);
+		std::memcpy(&vecRows[j].nGroup, pColumn + 4 * (4 * n + j), 4);
+		std::memcpy(&vecRows[j].nEvals, pColumn + 4 * (5 * n + j), 4);
+	}
+	return true;
+}
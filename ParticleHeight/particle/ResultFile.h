@@ -0,0 +1,90 @@
+#pragma once
+#include "Particle.h"
+#include "util/BlockWriter.h"
+#include <cstdint>
+#include <fstream>
+#include <list>
+#include <string>
+#include <vector>
+
+namespace ph
+{
+	// binary columnar particle results (.phr)
+	// layout: header, one block per frame, the frame index, then the trailer which locates the index from the end of the file
+	// each block is the frame number and particle count (uint32) followed by the columns x, y, z, confidence (float32),
+	// group id (int32) and evaluations (uint32), positions in the same coordinate system as the csv output
+	struct ResultFileHeader
+	{
+		char magic[4];  // "PHRS"
+		uint32_t nVersion;
+		uint32_t nColumns;
+		uint32_t nReserved;
+	};
+
+	struct ResultFrameIndex
+	{
+		uint32_t nFrame;
+		uint32_t nParticles;
+		uint64_t nOffset;  // start of the frame's block
+	};
+
+	struct ResultFileTrailer
+	{
+		uint64_t nIndexOffset;
+		uint64_t nFrames;
+		char magic[4];  // "PHRI"
+		uint32_t nReserved;
+	};
+
+	// one particle of a frame as read back from a result file
+	struct ResultRow
+	{
+		float x, y, z;
+		float fConfidence;
+		int32_t nGroup;
+		uint32_t nEvals;
+	};
+
+	class ResultWriter
+	{
+		// frames are encoded on the calling thread and written by a background thread in large buffered writes
+		// frames have to be written in order, the index is appended by close()
+		// sync() makes everything written so far durable, so a run can be resumed from there by passing the offset and index to resume()
+	public:
+		static const uint32_t nVersion = 1;
+		static const uint32_t nColumns = 6;
+	public:
+		ResultWriter() : m_fWallThickness(0) {};
+		~ResultWriter() { close(); };
+	public:
+		bool open(const std::string& file, const Settings* s);
+		bool resume(const std::string& file, const Settings* s, uint64_t nOffset, const std::vector<ResultFrameIndex>& vecIndex);
+		void write(int nFrame, const std::list<Particle>& listParticles);
+		bool sync() { return m_writer.sync(); };
+		bool close();
+		bool isOpened() const { return m_writer.isOpened(); };
+		uint64_t getOffset() const { return m_writer.getOffset(); };
+		const std::vector<ResultFrameIndex>& getIndex() const { return m_vecIndex; };
+	private:
+		BlockWriter m_writer;
+		float m_fWallThickness;  // subtracted from the heights like the csv output
+		std::vector<ResultFrameIndex> m_vecIndex;
+	};
+
+	class ResultReader
+	{
+		// random access to the frames of a result file through its index
+	public:
+		ResultReader() {};
+		~ResultReader() {};
+	public:
+		bool open(const std::string& file);
+		size_t getFrameCount() const { return m_vecIndex.size(); };
+		const ResultFrameIndex& getFrameIndex(size_t i) const { return m_vecIndex[i]; };
+		bool readFrame(size_t i, std::vector<ResultRow>& vecRows);
+	private:
+		std::ifstream m_file;
+		std::vector<ResultFrameIndex> m_vecIndex;
+		std::vector<char> m_vecBlock;
+	};
+}
@@ -0,0 +1,315 @@
+#include "TrajectoryLinker.h"
+#include <algorithm>
+#include <cstdlib>
+#include <functional>
+#include <limits>
+#include <math.h>
+#include "util/FileIO.h"
+
+using namespace ph;
+
+ph::TrajectoryLinker::TrajectoryLinker(float fMaxDisplacement, int nMaxSubnetSize) : m_fMaxDisplacement(fMaxDisplacement), m_nMaxSubnetSize(nMaxSubnetSize), m_nNextId(0)
+{
+}
+
+std::vector<int> ph::TrajectoryLinker::link(const std::vector<vf3>& vecPositions)
+{
+	// predict with the cell list of the previous frame, then put the new particles in cells the size of the search range
+	// so candidates are in the 27 cells around a prediction
+	std::vector<vf3> vecPredicted = m_predictPositions();
+	m_buildCells(vecPositions);
+
+	// find the candidate links of each particle in the previous frame
+	std::vector<candidate> vecCandidates;
+	float fRange2 = m_fMaxDisplacement * m_fMaxDisplacement;
+	for (size_t i = 0; i < vecPredicted.size(); i++)
+	{
+		const vf3& p = vecPredicted[i];
+		for (int dx = -1; dx <= 1; dx++)
+			for (int dy = -1; dy <= 1; dy++)
+				for (int dz = -1; dz <= 1; dz++)
+				{
+					auto it = m_mapCells.find(m_getCellKey(p + vf3(dx * m_fMaxDisplacement, dy * m_fMaxDisplacement, dz * m_fMaxDisplacement)));
+					if (it == m_mapCells.end())
+						continue;
+					for (int j : it->second)
+					{
+						float fCost = (vecPositions[j] - p).square();
+						if (fCost <= fRange2)
+							vecCandidates.push_back({ (int)i, j, fCost });
+					}
+				}
+	}
+
+	// choose the links
+	std::vector<int> vecSourceLink(vecPredicted.size(), -1);
+	m_solveSubnets(vecCandidates, m_fMaxDisplacement, vecSourceLink);
+
+	// linked particles continue their trajectory and get a velocity, the rest start new trajectories
+	std::vector<int> vecIds(vecPositions.size(), -1);
+	std::vector<vf3> vecVelocities(vecPositions.size());
+	std::vector<bool> vecLinked(vecPositions.size(), false);
+	for (size_t i = 0; i < vecSourceLink.size(); i++)
+		if (vecSourceLink[i] >= 0)
+		{
+			int j = vecSourceLink[i];
+			vecIds[j] = m_vecPrevIds[i];
+			vecVelocities[j] = vecPositions[j] - m_vecPrevPositions[i];
+			vecLinked[j] = true;
+		}
+	for (auto& id : vecIds)
+		if (id < 0)
+			id = m_nNextId++;
+
+	m_vecPrevPositions = vecPositions;
+	m_vecPrevIds = vecIds;
+	m_vecPrevVelocities = vecVelocities;
+	m_vecPrevLinked = vecLinked;
+	return vecIds;
+}
+
+void ph::TrajectoryLinker::save(std::ostream& os) const
+{
+	writeValue(os, (int32_t)m_nNextId);
+	writeVector(os, m_vecPrevPositions);
+	writeVector(os, m_vecPrevIds);
+	writeVector(os, m_vecPrevVelocities);
+	writeVector(os, std::vector<char>(m_vecPrevLinked.begin(), m_vecPrevLinked.end()));
+}
+
+bool ph::TrajectoryLinker::load(std::istream& is)
+{
+	int32_t nNextId;
+	std::vector<char> vecLinked;
+	if (!readValue(is, nNextId) || !readVector(is, m_vecPrevPositions) || !readVector(is, m_vecPrevIds) || !readVector(is, m_vecPrevVelocities)
+		|| !readVector(is, vecLinked))
+		return false;
+	m_nNextId = nNextId;
+	m_vecPrevLinked.assign(vecLinked.begin(), vecLinked.end());
+	m_buildCells(m_vecPrevPositions);
+	return m_vecPrevIds.size() == m_vecPrevPositions.size() && m_vecPrevVelocities.size() == m_vecPrevPositions.size() && m_vecPrevLinked.size() == m_vecPrevPositions.size();
+}
+
+std::vector<vf3> ph::TrajectoryLinker::m_predictPositions() const
+{
+	// linked particles move with their own velocity, the others with the velocity of the nearest linked particle
+	// the nearest one is searched in the previous frame's cell list, in shells of cells around the particle's cell until the next
+	// shell can't hold anything closer. with no linked particles nothing moves
+	std::vector<vf3> vecPredicted(m_vecPrevPositions);
+	int nCellMin[3] = { std::numeric_limits<int>::max(), std::numeric_limits<int>::max(), std::numeric_limits<int>::max() };
+	int nCellMax[3] = { std::numeric_limits<int>::min(), std::numeric_limits<int>::min(), std::numeric_limits<int>::min() };
+	auto getCell = [this](const vf3& v, int* c)
+	{
+		c[0] = (int)floorf(v.x / m_fMaxDisplacement);
+		c[1] = (int)floorf(v.y / m_fMaxDisplacement);
+		c[2] = (int)floorf(v.z / m_fMaxDisplacement);
+	};
+	for (size_t k = 0; k < m_vecPrevPositions.size(); k++)
+		if (m_vecPrevLinked[k])
+		{
+			int c[3];
+			getCell(m_vecPrevPositions[k], c);
+			for (int a = 0; a < 3; a++)
+			{
+				nCellMin[a] = std::min(nCellMin[a], c[a]);
+				nCellMax[a] = std::max(nCellMax[a], c[a]);
+			}
+		}
+
+	for (size_t i = 0; i < m_vecPrevPositions.size(); i++)
+	{
+		if (m_vecPrevLinked[i])
+		{
+			vecPredicted[i] += m_vecPrevVelocities[i];
+			continue;
+		}
+		if (nCellMin[0] > nCellMax[0])
+			continue;
+
+		// shells beyond the occupied cells are empty, ties go to the lowest index
+		int c[3];
+		getCell(m_vecPrevPositions[i], c);
+		int nMaxShell = 0;
+		for (int a = 0; a < 3; a++)
+			nMaxShell = std::max(nMaxShell, std::max(c[a] - nCellMin[a], nCellMax[a] - c[a]));
+		float fNearest = std::numeric_limits<float>::max();
+		int nNearest = -1;
+		for (int r = 0; r <= nMaxShell; r++)
+		{
+			// everything in shell r is at least r - 1 cells away
+			float fShellDistance = (r - 1) * m_fMaxDisplacement;
+			if (nNearest >= 0 && r > 1 && fNearest < fShellDistance * fShellDistance)
+				break;
+			for (int dx = -r; dx <= r; dx++)
+				for (int dy = -r; dy <= r; dy++)
+					for (int dz = -r; dz <= r; dz += (std::abs(dx) == r || std::abs(dy) == r) ? 1 : std::max(2 * r, 1))
+					{
+						auto it = m_mapCells.find(m_getCellKey(c[0] + dx, c[1] + dy, c[2] + dz));
+						if (it == m_mapCells.end())
+							continue;
+						for (int k : it->second)
+						{
+							float fDistance = (m_vecPrevPositions[k] - m_vecPrevPositions[i]).square();
+							if (m_vecPrevLinked[k] && (fDistance < fNearest || (fDistance == fNearest && k < nNearest)))
+							{
+								fNearest = fDistance;
+								nNearest = k;
+							}
+						}
+					}
+		}
+		if (nNearest >= 0)
+			vecPredicted[i] += m_vecPrevVelocities[nNearest];
+	}
+
+	return vecPredicted;
+}
+
+void ph::TrajectoryLinker::m_buildCells(const std::vector<vf3>& vecPositions)
+{
+	m_mapCells.clear();
+	for (size_t j = 0; j < vecPositions.size(); j++)
+		m_mapCells[m_getCellKey(vecPositions[j])].push_back((int)j);
+}
+
+int64_t ph::TrajectoryLinker::m_getCellKey(const vf3& v) const
+{
+	return m_getCellKey((int)floorf(v.x / m_fMaxDisplacement), (int)floorf(v.y / m_fMaxDisplacement), (int)floorf(v.z / m_fMaxDisplacement));
+}
+
+int64_t ph::TrajectoryLinker::m_getCellKey(int x, int y, int z) const
+{
+	// pack the cell coordinates into one key, 21 bits each
+	return (((int64_t)x & 0x1FFFFF) << 42) | (((int64_t)y & 0x1FFFFF) << 21) | ((int64_t)z & 0x1FFFFF);
+}
+
+void ph::TrajectoryLinker::m_solveSubnets(const std::vector<candidate>& vecCandidates, float fRange, std::vector<int>& vecSourceLink) const
+{
+	// split the candidates into subnets, particles connected through candidate links, with a union find over sources and destinations
+	// destinations are offset by the number of sources
+	int nSources = 0, nDests = 0;
+	for (auto& c : vecCandidates)
+	{
+		nSources = std::max(nSources, c.nSource + 1);
+		nDests = std::max(nDests, c.nDest + 1);
+	}
+	std::vector<int> vecParent(nSources + nDests);
+	for (size_t k = 0; k < vecParent.size(); k++)
+		vecParent[k] = (int)k;
+	std::function<int(int)> findRoot = [&](int k) { return vecParent[k] == k ? k : (vecParent[k] = findRoot(vecParent[k])); };
+	for (auto& c : vecCandidates)
+		vecParent[findRoot(c.nSource)] = findRoot(nSources + c.nDest);
+
+	std::unordered_map<int, std::vector<candidate>> mapSubnets;
+	for (auto& c : vecCandidates)
+		mapSubnets[findRoot(c.nSource)].push_back(c);
+
+	for (auto& subnet : mapSubnets)
+	{
+		std::vector<candidate>& vecSubnet = subnet.second;
+		std::vector<int> vecSources, vecDests;
+		for (auto& c : vecSubnet)
+		{
+			vecSources.push_back(c.nSource);
+			vecDests.push_back(c.nDest);
+		}
+		std::sort(vecSources.begin(), vecSources.end());
+		std::sort(vecDests.begin(), vecDests.end());
+		int nSize = (int)std::max(std::unique(vecSources.begin(), vecSources.end()) - vecSources.begin(), std::unique(vecDests.begin(), vecDests.end()) - vecDests.begin());
+
+		if (nSize <= m_nMaxSubnetSize)
+			m_solveSubnet(vecSubnet, vecSourceLink);
+		else
+		{
+			// too large to solve exactly, drop its longest candidates and split it again
+			float fShrunk = 0.95f * fRange;
+			std::vector<candidate> vecShrunk;
+			for (auto& c : vecSubnet)
+				if (c.fCost <= fShrunk * fShrunk)
+					vecShrunk.push_back(c);
+			m_solveSubnets(vecShrunk, fShrunk, vecSourceLink);
+		}
+	}
+}
+
+void ph::TrajectoryLinker::m_solveSubnet(const std::vector<candidate>& vecCandidates, std::vector<int>& vecSourceLink) const
+{
+	// exact assignment of the subnet's sources to destinations or to no link with the hungarian method, each source has its own
+	// no link column so the cost matrix is the sources by the destinations followed by the sources
+	std::vector<int> vecSources, vecDests;
+	for (auto& c : vecCandidates)
+	{
+		vecSources.push_back(c.nSource);
+		vecDests.push_back(c.nDest);
+	}
+	std::sort(vecSources.begin(), vecSources.end());
+	vecSources.erase(std::unique(vecSources.begin(), vecSources.end()), vecSources.end());
+	std::sort(vecDests.begin(), vecDests.end());
+	vecDests.erase(std::unique(vecDests.begin(), vecDests.end()), vecDests.end());
+
+	const double dForbidden = 1e30;
+	int nRows = (int)vecSources.size(), nCols = (int)(vecDests.size() + vecSources.size());
+	std::vector<double> vecCost((size_t)nRows * nCols, dForbidden);
+	for (auto& c : vecCandidates)
+	{
+		int r = (int)(std::lower_bound(vecSources.begin(), vecSources.end(), c.nSource) - vecSources.begin());
+		int col = (int)(std::lower_bound(vecDests.begin(), vecDests.end(), c.nDest) - vecDests.begin());
+		vecCost[(size_t)r * nCols + col] = c.fCost;
+	}
+	for (int r = 0; r < nRows; r++)
+		vecCost[(size_t)r * nCols + vecDests.size() + r] = (double)m_fMaxDisplacement * m_fMaxDisplacement;
+
+	// shortest augmenting paths with row and column potentials, rows and columns are 1 based with column 0 as the path root
+	std::vector<double> vecU(nRows + 1, 0), vecV(nCols + 1, 0), vecMin(nCols + 1);
+	std::vector<int> vecRowOfCol(nCols + 1, 0), vecPrevCol(nCols + 1, 0);
+	std::vector<bool> vecVisited(nCols + 1);
+	for (int r = 1; r <= nRows; r++)
+	{
+		vecRowOfCol[0] = r;
+		int nCol = 0;
+		std::fill(vecMin.begin(), vecMin.end(), std::numeric_limits<double>::max());
+		std::fill(vecVisited.begin(), vecVisited.end(), false);
+		do
+		{
+			vecVisited[nCol] = true;
+			int nRow = vecRowOfCol[nCol], nNext = 0;
+			double dDelta = std::numeric_limits<double>::max();
+			for (int col = 1; col <= nCols; col++)
+				if (!vecVisited[col])
+				{
+					double dReduced = vecCost[(size_t)(nRow - 1) * nCols + col - 1] - vecU[nRow] - vecV[col];
+					if (dReduced < vecMin[col])
+					{
+						vecMin[col] = dReduced;
+						vecPrevCol[col] = nCol;
+					}
+					if (vecMin[col] < dDelta)
+					{
+						dDelta = vecMin[col];
+						nNext = col;
+					}
+				}
+			for (int col = 0; col <= nCols; col++)
+				if (vecVisited[col])
+				{
+					vecU[vecRowOfCol[col]] += dDelta;
+					vecV[col] -= dDelta;
+				}
+				else
+					vecMin[col] -= dDelta;
+			nCol = nNext;
+		} while (vecRowOfCol[nCol] != 0);
+
+		// flip the augmenting path
+		do
+		{
+			int nPrev = vecPrevCol[nCol];
+			vecRowOfCol[nCol] = vecRowOfCol[nPrev];
+			nCol = nPrev;
+		} while (nCol != 0);
+	}
+
+	for (int col = 1; col <= (int)vecDests.size(); col++)
+		if (vecRowOfCol[col] != 0)
+			vecSourceLink[vecSources[vecRowOfCol[col] - 1]] = vecDests[col - 1];
+}
@@ -0,0 +1,49 @@
+#pragma once
+#include "util/vf3.h"
+#include <cstdint>
+#include <istream>
+#include <ostream>
+#include <unordered_map>
+#include <vector>
+
+namespace ph
+{
+	class TrajectoryLinker
+	{
+		// links the particle positions of consecutive frames into trajectories, like trackpy's NearestVelocityPredict linking with no memory
+		// each particle of the previous frame is moved by the velocity of the nearest particle that was linked into the previous frame
+		// (its own if it was linked) and matched to the new particles within fMaxDisplacement of that prediction. candidates come from a
+		// cell list, and each connected subnet of candidate links is solved exactly for the smallest total squared displacement, leaving
+		// a particle unlinked costs fMaxDisplacement^2. a subnet with more than nMaxSubnetSize particles is split by shrinking its search
+		// range rather than failing
+	public:
+		TrajectoryLinker(float fMaxDisplacement, int nMaxSubnetSize = 45);
+		~TrajectoryLinker() {};
+	public:
+		std::vector<int> link(const std::vector<vf3>& vecPositions);  // frames in order, returns the trajectory id of each position
+		int getTrajectoryCount() const { return m_nNextId; };
+		void save(std::ostream& os) const;  // the state carried to the next frame, for checkpoints
+		bool load(std::istream& is);
+	private:
+		struct candidate
+		{
+			int nSource, nDest;
+			float fCost;  // squared distance from the predicted position
+		};
+		float m_fMaxDisplacement;
+		int m_nMaxSubnetSize;
+		int m_nNextId;
+		std::vector<vf3> m_vecPrevPositions;
+		std::vector<int> m_vecPrevIds;
+		std::vector<vf3> m_vecPrevVelocities;
+		std::vector<bool> m_vecPrevLinked;  // whether the particle was linked into its frame, and so has a velocity
+		std::unordered_map<int64_t, std::vector<int>> m_mapCells;  // cell list of the new frame, kept as the previous frame's for the next one
+	private:
+		std::vector<vf3> m_predictPositions() const;
+		void m_buildCells(const std::vector<vf3>& vecPositions);
+		int64_t m_getCellKey(const vf3& v) const;
+		int64_t m_getCellKey(int x, int y, int z) const;
+		void m_solveSubnets(const std::vector<candidate>& vecCandidates, float fRange, std::vector<int>& vecSourceLink) const;
+		void m_solveSubnet(const std::vector<candidate>& vecCandidates, std::vector<int>& vecSourceLink) const;
+	};
+}
@@ -25,13 +25,7 @@ bool ph::TransformSingle::operator() (int& pxPosX, int& pxPosY) const
 	else
 	{
 		// determine the transformed radius
-		if (m_bFastTransform)
-		{
-			float dr = m_vecTransformedRadii[(int)radius + 1] - m_vecTransformedRadii[(int)radius];
-			radius = m_vecTransformedRadii[(int)radius] + (radius - (int)radius) * dr;  // interpolate
-		}
-		else
-			radius = Particle::realToPx(m_getTransformedRadiusAnalytic(Particle::pxToReal(radius)));  // exact calculation
+		radius = m_transformRadius(radius);
 
 		float theta = atan2f(midpoint - pxPosY, pxPosX - midpoint);
 		pxPosX = (radius * cosf(theta)) + midpoint;
@@ -40,6 +34,18 @@ bool ph::TransformSingle::operator() (int& pxPosX, int& pxPosY) const
 	}
 }
 
+float ph::TransformSingle::m_transformRadius(float radius) const
+{
+	// radius in px from the DIC region center
+	if (m_bFastTransform)
+	{
+		float dr = m_vecTransformedRadii[(int)radius + 1] - m_vecTransformedRadii[(int)radius];
+		return m_vecTransformedRadii[(int)radius] + (radius - (int)radius) * dr;  // interpolate
+	}
+	else
+		return Particle::realToPx(m_getTransformedRadiusAnalytic(Particle::pxToReal(radius)));  // exact calculation
+}
+
 float ph::TransformSingle::m_getTransformedRadiusAnalytic(float originalRadius) const
 {
 	float particleRadius = m_pParticle->getRadiusReal();
@@ -1,5 +1,6 @@
 #pragma once
 #include "Particle.h"
+#include "DICRegionTable.h"
 #include "util/Settings.h"
 
 namespace ph
@@ -12,12 +13,57 @@ namespace ph
 		~TransformSingle() {};
 	public:
 		bool operator() (int& pxPosX, int& pxPosY) const;
+	protected:
+		float m_transformRadius(float radius) const;
 	private:
 		float m_getTransformedRadiusAnalytic(float originalRadius) const;
-	private:
+	protected:
 		const Particle* m_pParticle;
 		const Settings* m_pSettings;
 		bool m_bFastTransform;
 		std::vector<float> m_vecTransformedRadii;
 	};
+
+	template <int N>
+	class TransformSingleFixed : public TransformSingle
+	{
+		// analytical transform specialized on an N x N DIC region, the pixel radius and direction come from a compile time table
+	public:
+		TransformSingleFixed(const Particle* p, const Settings* s, bool fastTransform = false) : TransformSingle(p, s, fastTransform) {};
+		~TransformSingleFixed() {};
+	public:
+		bool operator() (int& pxPosX, int& pxPosY) const
+		{
+			// pxPosX and pxPosY are coordinates with respect to the DIC region
+			const DICRegionTable<N>& table = DICRegion<N>::table;
+			int i = pxPosY * N + pxPosX;
+			float radius = table.radius[i];
+			if (radius == 0)
+				return true;  // center point is not transformed
+			else if (radius > m_pParticle->getRadiusPx())
+				return false;  // point is outside the circle so can't transform it
+			else
+			{
+				// scale the offset from the center by the transformed radius
+				radius = m_transformRadius(radius);
+				pxPosX = (radius * table.dirX[i]) + (N >> 1);
+				pxPosY = (radius * table.dirY[i]) + (N >> 1);
+				return true;
+			}
+		}
+	};
+
+	template <class F>
+	auto applyTransformSingle(const Particle* p, const Settings* s, F f, bool fastTransform = false)
+	{
+		// call f with the analytical transform for this particle, using a specialized kernel if there is one for the DIC region size
+		switch (p->getSizeCorrelation())
+		{
+		case 41: return f(TransformSingleFixed<41>(p, s, fastTransform));
+		case 51: return f(TransformSingleFixed<51>(p, s, fastTransform));
+		case 61: return f(TransformSingleFixed<61>(p, s, fastTransform));
+		case 81: return f(TransformSingleFixed<81>(p, s, fastTransform));
+		default: return f(TransformSingle(p, s, fastTransform));
+		}
+	}
 }
@@ -3,8 +3,11 @@
 
 using namespace ph;
 
+static thread_local uint64_t g_nRaysTraced = 0;
+
 vf3 ph::OpticalScene::getRayTermination(Ray& ray) const
 {
+	g_nRaysTraced++;
 	m_updateRayRefractionIndex(ray);
 	return m_traceRay(ray);
 }
@@ -16,12 +19,12 @@ vf3 ph::OpticalScene::m_traceRay(Ray& ray, unsigned int depth) const
 		return ray.getOrigin();
 
 	// find the first object the ray hits
-	std::shared_ptr<OpticalMedium> pIntersectedObject = nullptr;
+	const OpticalMedium* pIntersectedObject = nullptr;
 	float fIntersectDistance, fMinDistance = INFINITY;
-	for (auto medium : m_vecpOpticalMedia)
+	for (const auto& medium : m_vecpOpticalMedia)
 		if (medium->getIntersection(fIntersectDistance, ray) && fIntersectDistance < fMinDistance)
 		{
-			pIntersectedObject = medium;
+			pIntersectedObject = medium.get();
 			fMinDistance = fIntersectDistance;
 		}
 
@@ -57,12 +60,17 @@ vf3 ph::OpticalScene::m_traceRay(Ray& ray, unsigned int depth) const
 	}
 }
 
+uint64_t ph::OpticalScene::getRaysTraced()
+{
+	return g_nRaysTraced;
+}
+
 void ph::OpticalScene::m_updateRayRefractionIndex(Ray& ray) const
 {
 	//set the ray's current refraction index depending on its location in the scene
 	ray.setRefractionIndex(this->m_refractionIndex);
 
-	for (auto pMedium : m_vecpOpticalMedia)
+	for (const auto& pMedium : m_vecpOpticalMedia)
 	{
 		if (pMedium->containsPoint(ray.getOrigin()))
 		{
@@ -75,7 +83,7 @@ void ph::OpticalScene::m_updateRayRefractionIndex(Ray& ray) const
 bool ph::OpticalScene::posOverlapsSeveralParticles(float posX, float posY) const
 {
 	int nOverlaps = 0;
-	for (auto pMedium : m_vecpOpticalMedia)
+	for (const auto& pMedium : m_vecpOpticalMedia)
 		if (pMedium->isParticle())
 		{
 			OpticalSphere* s = (OpticalSphere*)pMedium.get();
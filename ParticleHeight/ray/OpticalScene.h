@@ -1,4 +1,5 @@
 #pragma once
+#include <cstdint>
 #include <vector>
 #include <memory>
 #include "OpticalMedium.h"
@@ -15,8 +16,11 @@ namespace ph
 		~OpticalScene() {};
 	public:
 		void addMedium(std::shared_ptr<OpticalMedium> pOpticalObject) { m_vecpOpticalMedia.push_back(pOpticalObject); };
+		void clearMedia() { m_vecpOpticalMedia.clear(); };  // keeps the capacity so the scene can be rebuilt without allocating
+		void setRefractionIndex(float refractionIndex) { m_refractionIndex = refractionIndex; };
 		std::vector<std::shared_ptr<OpticalMedium>>& getMedia() { return m_vecpOpticalMedia; };
 		vf3 getRayTermination(Ray& ray) const;
+		static uint64_t getRaysTraced();  // rays traced by the calling thread so far, for the frame metrics
 	public:
 		bool posOverlapsSeveralParticles(float posX, float posY) const;
 	private:
@@ -0,0 +1,139 @@
+#include "BlockWriter.h"
+#include "FileIO.h"
+
+using namespace ph;
+
+namespace
+{
+	const size_t nWriteBufferSize = 4 << 20;
+}
+
+bool ph::BlockWriter::open(const std::string& file)
+{
+	close();
+	m_file.open(file, std::ios::binary | std::ios::trunc);
+	if (!m_file.is_open())
+		return false;
+
+	m_nOffset = 0;
+	m_start();
+	return true;
+}
+
+bool ph::BlockWriter::resume(const std::string& file, uint64_t nOffset)
+{
+	close();
+	if (!truncateFile(file, nOffset))
+		return false;
+	m_file.open(file, std::ios::binary | std::ios::app);
+	if (!m_file.is_open())
+		return false;
+
+	m_nOffset = nOffset;
+	m_start();
+	return true;
+}
+
+void ph::BlockWriter::write(std::vector<char>&& vecBlock)
+{
+	m_nOffset += vecBlock.size();
+
+	// hand it to the writer thread
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_queueBlocks.push_back(std::move(vecBlock));
+	}
+	m_cvBlocks.notify_one();
+}
+
+void ph::BlockWriter::write(const void* pData, size_t nBytes)
+{
+	write(std::vector<char>((const char*)pData, (const char*)pData + nBytes));
+}
+
+bool ph::BlockWriter::sync()
+{
+	// wait for the writer thread to write and flush the blocks queued so far
+	if (!m_file.is_open())
+		return false;
+	std::unique_lock<std::mutex> lock(m_mutex);
+	m_bSyncing = true;
+	m_cvBlocks.notify_one();
+	m_cvSynced.wait(lock, [this]() { return !m_bSyncing; });
+	return !m_bFailed;
+}
+
+bool ph::BlockWriter::close()
+{
+	if (!m_file.is_open())
+		return false;
+
+	// let the writer thread finish the blocks
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_bClosing = true;
+	}
+	m_cvBlocks.notify_one();
+	m_thread.join();
+
+	bool bOK = !m_bFailed && (bool)m_file;
+	m_file.close();
+	return bOK;
+}
+
+void ph::BlockWriter::m_start()
+{
+	m_queueBlocks.clear();
+	m_bClosing = false;
+	m_bSyncing = false;
+	m_bFailed = false;
+	m_thread = std::thread(&BlockWriter::m_writeLoop, this);
+}
+
+void ph::BlockWriter::m_writeLoop()
+{
+	// gather the blocks into a large buffer, writing it out when full and when the file is closed
+	std::vector<char> vecBuffer;
+	vecBuffer.reserve(nWriteBufferSize);
+	std::unique_lock<std::mutex> lock(m_mutex);
+	while (true)
+	{
+		m_cvBlocks.wait(lock, [this]() { return m_bClosing || m_bSyncing || !m_queueBlocks.empty(); });
+		std::deque<std::vector<char>> queueBlocks;
+		queueBlocks.swap(m_queueBlocks);
+		bool bClosing = m_bClosing;
+		bool bSyncing = m_bSyncing;
+		lock.unlock();
+
+		for (auto& vecBlock : queueBlocks)
+		{
+			if (vecBuffer.size() + vecBlock.size() > nWriteBufferSize && !vecBuffer.empty())
+			{
+				m_file.write(vecBuffer.data(), vecBuffer.size());
+				vecBuffer.clear();
+			}
+			vecBuffer.insert(vecBuffer.end(), vecBlock.begin(), vecBlock.end());
+		}
+
+		if (bClosing)
+		{
+			m_file.write(vecBuffer.data(), vecBuffer.size());
+			m_bFailed = !m_file;
+			return;
+		}
+		if (bSyncing)
+		{
+			// everything queued before the sync is in the buffer
+			m_file.write(vecBuffer.data(), vecBuffer.size());
+			m_file.flush();
+			vecBuffer.clear();
+		}
+		lock.lock();
+		if (bSyncing)
+		{
+			m_bFailed = !m_file;
+			m_bSyncing = false;
+			m_cvSynced.notify_one();
+		}
+	}
+}
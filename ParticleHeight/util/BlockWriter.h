@@ -0,0 +1,46 @@
+#pragma once
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace ph
+{
+	class BlockWriter
+	{
+		// appends blocks to a file in the order they are written, from a background thread in large buffered writes
+		// sync() makes everything written so far durable, so a file can be continued from there by passing the offset to resume()
+	public:
+		BlockWriter() : m_nOffset(0), m_bClosing(false), m_bSyncing(false), m_bFailed(false) {};
+		~BlockWriter() { close(); };
+		BlockWriter(const BlockWriter&) = delete;
+		BlockWriter& operator=(const BlockWriter&) = delete;
+	public:
+		bool open(const std::string& file);
+		bool resume(const std::string& file, uint64_t nOffset);  // drops everything after nOffset
+		void write(std::vector<char>&& vecBlock);
+		void write(const void* pData, size_t nBytes);
+		bool sync();
+		bool close();
+		bool isOpened() const { return m_file.is_open(); };
+		uint64_t getOffset() const { return m_nOffset; };  // where the next block starts
+	private:
+		std::ofstream m_file;
+		uint64_t m_nOffset;
+		std::thread m_thread;
+		std::mutex m_mutex;
+		std::condition_variable m_cvBlocks;
+		std::condition_variable m_cvSynced;
+		std::deque<std::vector<char>> m_queueBlocks;
+		bool m_bClosing;
+		bool m_bSyncing;
+		bool m_bFailed;
+	private:
+		void m_start();
+		void m_writeLoop();
+	};
+}
@@ -0,0 +1,26 @@
+#include "FileIO.h"
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#include <share.h>
+#include <sys/stat.h>
+#else
+#include <sys/types.h>
+#include <unistd.h>
+#endif
+
+using namespace ph;
+
+bool ph::truncateFile(const std::string& file, uint64_t nSize)
+{
+#ifdef _WIN32
+	int fd;
+	if (_sopen_s(&fd, file.c_str(), _O_RDWR | _O_BINARY, _SH_DENYNO, _S_IREAD | _S_IWRITE) != 0)
+		return false;
+	bool bOK = (_chsize_s(fd, (__int64)nSize) == 0);
+	_close(fd);
+	return bOK;
+#else
+	return truncate(file.c_str(), (off_t)nSize) == 0;
+#endif
+}
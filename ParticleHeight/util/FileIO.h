@@ -0,0 +1,36 @@
+#pragma once
+#include <cstdint>
+#include <istream>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace ph
+{
+	// raw binary values and vectors of plain structs, in the byte order of the machine like the other binary files
+	template<class T>
+	void writeValue(std::ostream& os, const T& value) { os.write((const char*)&value, sizeof(T)); }
+
+	template<class T>
+	bool readValue(std::istream& is, T& value) { return (bool)is.read((char*)&value, sizeof(T)); }
+
+	template<class T>
+	void writeVector(std::ostream& os, const std::vector<T>& vec)
+	{
+		writeValue(os, (uint64_t)vec.size());
+		os.write((const char*)vec.data(), vec.size() * sizeof(T));
+	}
+
+	template<class T>
+	bool readVector(std::istream& is, std::vector<T>& vec)
+	{
+		uint64_t nSize;
+		if (!readValue(is, nSize))
+			return false;
+		vec.resize((size_t)nSize);
+		return (bool)is.read((char*)vec.data(), vec.size() * sizeof(T));
+	}
+
+	// cuts a file to nSize bytes, dropping whatever was written after a checkpoint
+	bool truncateFile(const std::string& file, uint64_t nSize);
+}
@@ -0,0 +1,117 @@
+#include "FrameMetrics.h"
+#include "FileIO.h"
+#include <algorithm>
+#include <iomanip>
+
+using namespace ph;
+
+const char* ph::FrameMetrics::getStageName(int nStage)
+{
+	static const char* names[STAGE_COUNT] = { "decode", "convert", "align", "background", "morphology", "circles", "heights", "output" };
+	return names[nStage];
+}
+
+bool ph::MetricsWriter::open(const std::string& file)
+{
+	m_bCSV = (file.size() >= 4 && file.substr(file.size() - 4) == ".csv");
+	m_file.open(file);
+	if (!m_file.is_open())
+		return false;
+
+	if (m_bCSV)
+	{
+		m_file << "frame";
+		for (int s = 0; s < FrameMetrics::STAGE_COUNT; s++)
+			m_file << "," << FrameMetrics::getStageName(s) << "_ms";
+		m_file << ",alignment,align_iterations,particles,groups,evals,rays\n";
+	}
+	m_vecFrames.clear();
+	return true;
+}
+
+bool ph::MetricsWriter::resume(const std::string& file, uint64_t nOffset)
+{
+	m_bCSV = (file.size() >= 4 && file.substr(file.size() - 4) == ".csv");
+	if (!truncateFile(file, nOffset))
+		return false;
+	m_file.open(file, std::ios::in | std::ios::out);
+	if (!m_file.is_open())
+		return false;
+	m_file.seekp(0, std::ios::end);
+	m_vecFrames.clear();
+	return true;
+}
+
+void ph::MetricsWriter::write(const FrameMetrics& metrics)
+{
+	m_vecFrames.push_back(metrics);
+	if (!m_file.is_open())
+		return;
+
+	if (m_bCSV)
+	{
+		m_file << metrics.nFrame;
+		for (int s = 0; s < FrameMetrics::STAGE_COUNT; s++)
+			m_file << "," << metrics.dStageMs[s];
+		m_file << "," << metrics.dAlignment << "," << metrics.nAlignIterations << "," << metrics.nParticles << "," << metrics.nGroups << "," << metrics.nEvals << "," << metrics.nRays << "\n";
+	}
+	else
+	{
+		m_file << "{\"frame\": " << metrics.nFrame;
+		for (int s = 0; s < FrameMetrics::STAGE_COUNT; s++)
+			m_file << ", \"" << FrameMetrics::getStageName(s) << "_ms\": " << metrics.dStageMs[s];
+		m_file << ", \"alignment\": " << metrics.dAlignment << ", \"align_iterations\": " << metrics.nAlignIterations << ", \"particles\": " << metrics.nParticles << ", \"groups\": " << metrics.nGroups
+			<< ", \"evals\": " << metrics.nEvals << ", \"rays\": " << metrics.nRays << "}\n";
+	}
+}
+
+bool ph::MetricsWriter::sync()
+{
+	if (!m_file.is_open())
+		return false;
+	m_file.flush();
+	return (bool)m_file;
+}
+
+bool ph::MetricsWriter::close()
+{
+	if (!m_file.is_open())
+		return false;
+	bool bOK = (bool)m_file;
+	m_file.close();
+	return bOK;
+}
+
+void ph::MetricsWriter::printSummary(std::ostream& os) const
+{
+	if (m_vecFrames.empty())
+		return;
+
+	// nearest rank percentiles
+	auto printRow = [&](const char* name, std::vector<double> vecValues)
+	{
+		std::sort(vecValues.begin(), vecValues.end());
+		auto percentile = [&](double p) { return vecValues[std::min(vecValues.size() - 1, (size_t)(p * vecValues.size()))]; };
+		os << std::setw(12) << name << std::setw(12) << percentile(0.5) << std::setw(12) << percentile(0.95) << std::setw(12) << vecValues.back() << std::endl;
+	};
+
+	os << "metrics over " << m_vecFrames.size() << " frames:" << std::endl;
+	os << std::setw(12) << "" << std::setw(12) << "p50" << std::setw(12) << "p95" << std::setw(12) << "max" << std::endl;
+	std::vector<double> vecValues(m_vecFrames.size());
+	for (int s = 0; s < FrameMetrics::STAGE_COUNT; s++)
+	{
+		for (size_t i = 0; i < m_vecFrames.size(); i++)
+			vecValues[i] = m_vecFrames[i].dStageMs[s];
+		printRow((std::string(FrameMetrics::getStageName(s)) + " ms").c_str(), vecValues);
+	}
+	for (size_t i = 0; i < m_vecFrames.size(); i++) vecValues[i] = m_vecFrames[i].nAlignIterations;
+	printRow("align iters", vecValues);
+	for (size_t i = 0; i < m_vecFrames.size(); i++) vecValues[i] = m_vecFrames[i].nParticles;
+	printRow("particles", vecValues);
+	for (size_t i = 0; i < m_vecFrames.size(); i++) vecValues[i] = m_vecFrames[i].nGroups;
+	printRow("groups", vecValues);
+	for (size_t i = 0; i < m_vecFrames.size(); i++) vecValues[i] = (double)m_vecFrames[i].nEvals;
+	printRow("evals", vecValues);
+	for (size_t i = 0; i < m_vecFrames.size(); i++) vecValues[i] = (double)m_vecFrames[i].nRays;
+	printRow("rays", vecValues);
+}
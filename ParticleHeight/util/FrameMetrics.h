@@ -0,0 +1,83 @@
+#pragma once
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <ostream>
+#include <string>
+#include <vector>
+#include "TraceRecorder.h"
+
+namespace ph
+{
+	// time spent in each stage of one frame and what the frame held, filled in as the frame goes through the pipeline
+	struct FrameMetrics
+	{
+		enum Stage
+		{
+			STAGE_DECODE = 0,
+			STAGE_CONVERT,  // grayscale conversion, only for decoders that return color
+			STAGE_ALIGN,
+			STAGE_BACKGROUND,
+			STAGE_MORPHOLOGY,
+			STAGE_CIRCLES,  // EDT or Hough
+			STAGE_HEIGHTS,
+			STAGE_OUTPUT,
+			STAGE_COUNT
+		};
+		static const char* getStageName(int nStage);
+
+		FrameMetrics() : nFrame(0), dAlignment(0), nAlignIterations(0), nParticles(0), nGroups(0), nEvals(0), nRays(0) { for (auto& d : dStageMs) d = 0; };
+
+		int nFrame;
+		double dStageMs[STAGE_COUNT];
+		double dAlignment;  // correlation coefficient of the alignment
+		int nAlignIterations;  // ECC iterations of the alignment, 0 for frames that were already aligned
+		int nParticles;
+		int nGroups;  // overlapping groups of more than one particle
+		uint64_t nEvals;  // objective evaluations of the height optimizers
+		uint64_t nRays;  // rays traced through the optical scenes
+	};
+
+	class StageTimer
+	{
+		// adds the time between its construction and destruction to a stage and to the trace if one is recorded, does nothing without metrics
+	public:
+		StageTimer(FrameMetrics* pMetrics, FrameMetrics::Stage stage) : m_pMetrics(pMetrics), m_stage(stage)
+		{
+			if (m_pMetrics) m_startTime = std::chrono::steady_clock::now();
+		};
+		~StageTimer()
+		{
+			if (m_pMetrics)
+			{
+				auto endTime = std::chrono::steady_clock::now();
+				m_pMetrics->dStageMs[m_stage] += std::chrono::duration<double, std::milli>(endTime - m_startTime).count();
+				TraceRecorder::record(FrameMetrics::getStageName(m_stage), m_startTime, endTime, m_pMetrics->nFrame);
+			}
+		};
+	private:
+		FrameMetrics* m_pMetrics;
+		FrameMetrics::Stage m_stage;
+		std::chrono::steady_clock::time_point m_startTime;
+	};
+
+	class MetricsWriter
+	{
+		// writes the metrics of each frame as a json line, or a csv row if the file ends in .csv, and keeps them for the summary
+	public:
+		MetricsWriter() : m_bCSV(false) {};
+		~MetricsWriter() {};
+	public:
+		bool open(const std::string& file);
+		bool resume(const std::string& file, uint64_t nOffset);  // continue from an offset returned by getOffset() after a sync
+		void write(const FrameMetrics& metrics);  // frames in order
+		bool sync();
+		uint64_t getOffset() { return (uint64_t)m_file.tellp(); };
+		bool close();
+		void printSummary(std::ostream& os) const;  // p50, p95 and max of each stage over the frames written since opening
+	private:
+		std::ofstream m_file;
+		bool m_bCSV;
+		std::vector<FrameMetrics> m_vecFrames;
+	};
+}
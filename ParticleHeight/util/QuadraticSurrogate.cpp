@@ -0,0 +1,96 @@
+#include "QuadraticSurrogate.h"
+#include <opencv2/core.hpp>
+#include <algorithm>
+#include <math.h>
+
+using namespace ph;
+
+bool ph::QuadraticSurrogate::fit(const std::vector<std::vector<double>>& vecPoints, const std::vector<double>& vecValues)
+{
+	// needs at least as many points as there are terms in the model
+	size_t nTerms = getNumTerms(m_vecCenter.size());
+	if (vecPoints.size() < nTerms)
+		return false;
+
+	cv::Mat matTerms((int)vecPoints.size(), (int)nTerms, CV_64F);
+	cv::Mat matValues((int)vecPoints.size(), 1, CV_64F);
+	for (size_t i = 0; i < vecPoints.size(); ++i)
+	{
+		m_getTerms(vecPoints[i], matTerms.ptr<double>((int)i));
+		matValues.at<double>((int)i) = vecValues[i];
+	}
+
+	// svd handles points that don't span every direction
+	cv::Mat matCoefficients;
+	if (!cv::solve(matTerms, matValues, matCoefficients, cv::DECOMP_SVD))
+		return false;
+
+	m_vecCoefficients.assign(matCoefficients.begin<double>(), matCoefficients.end<double>());
+	return true;
+}
+
+double ph::QuadraticSurrogate::predict(const std::vector<double>& vecPoint) const
+{
+	std::vector<double> vecTerms(m_vecCoefficients.size());
+	m_getTerms(vecPoint, vecTerms.data());
+
+	double f = 0;
+	for (size_t i = 0; i < vecTerms.size(); ++i)
+		f += m_vecCoefficients[i] * vecTerms[i];
+	return f;
+}
+
+std::vector<double> ph::QuadraticSurrogate::getMinimum(double fTrustRadius) const
+{
+	// minimum of the model within fTrustRadius scaled units of the center
+	// the stationary point is used when the model is convex, otherwise (or if it lies outside the trust region) the step is
+	// taken downhill along the stationary or steepest descent direction and clipped to the trust radius
+	int nDims = (int)m_vecCenter.size();
+	cv::Mat matGradient(nDims, 1, CV_64F), matHessian(nDims, nDims, CV_64F);
+	int k = 1 + nDims;
+	for (int i = 0; i < nDims; ++i)
+	{
+		matGradient.at<double>(i) = m_vecCoefficients[1 + i];
+		for (int j = i; j < nDims; ++j, ++k)
+		{
+			matHessian.at<double>(i, j) = (i == j) ? 2 * m_vecCoefficients[k] : m_vecCoefficients[k];
+			matHessian.at<double>(j, i) = matHessian.at<double>(i, j);
+		}
+	}
+
+	cv::Mat matEigenvalues;
+	cv::eigen(matHessian, matEigenvalues);
+	bool bConvex = true;
+	for (int i = 0; i < nDims; ++i)
+		bConvex &= matEigenvalues.at<double>(i) > 0;
+
+	cv::Mat matStep;
+	if (!bConvex || !cv::solve(matHessian, -matGradient, matStep, cv::DECOMP_SVD))
+		matStep = -matGradient;
+
+	double fStepLength = cv::norm(matStep);
+	if (fStepLength > fTrustRadius || (!bConvex && fStepLength > 0))
+		matStep *= fTrustRadius / fStepLength;
+
+	std::vector<double> vecMinimum(nDims);
+	for (int i = 0; i < nDims; ++i)
+		vecMinimum[i] = m_vecCenter[i] + matStep.at<double>(i) * m_vecScale[i];
+	return vecMinimum;
+}
+
+void ph::QuadraticSurrogate::m_getTerms(const std::vector<double>& vecPoint, double* terms) const
+{
+	// 1, x_i, x_i * x_j for i <= j
+	size_t nDims = m_vecCenter.size();
+	std::vector<double> x(nDims);
+	for (size_t i = 0; i < nDims; ++i)
+		x[i] = (vecPoint[i] - m_vecCenter[i]) / m_vecScale[i];
+
+	size_t k = 0;
+	terms[k++] = 1;
+	for (size_t i = 0; i < nDims; ++i)
+		terms[k++] = x[i];
+	for (size_t i = 0; i < nDims; ++i)
+		for (size_t j = i; j < nDims; ++j)
+			terms[k++] = x[i] * x[j];
+}
@@ -0,0 +1,25 @@
+#pragma once
+#include <cstddef>
+#include <vector>
+
+namespace ph
+{
+	class QuadraticSurrogate
+	{
+		// least squares quadratic model of an expensive objective, used to propose new candidates from the points already evaluated
+		// points are fitted in coordinates relative to a center and divided by a per-dimension scale so the parameters are comparable
+	public:
+		QuadraticSurrogate(const std::vector<double>& vecCenter, const std::vector<double>& vecScale) : m_vecCenter(vecCenter), m_vecScale(vecScale) {};
+		~QuadraticSurrogate() {};
+	public:
+		bool fit(const std::vector<std::vector<double>>& vecPoints, const std::vector<double>& vecValues);
+		double predict(const std::vector<double>& vecPoint) const;
+		std::vector<double> getMinimum(double fTrustRadius) const;
+		static size_t getNumTerms(size_t nDims) { return 1 + nDims + nDims * (nDims + 1) / 2; };
+	private:
+		std::vector<double> m_vecCenter, m_vecScale;
+		std::vector<double> m_vecCoefficients;  // constant, linear, then the upper triangle of the quadratic terms
+	private:
+		void m_getTerms(const std::vector<double>& vecPoint, double* terms) const;
+	};
+}
@@ -1,5 +1,6 @@
 #include "Settings.h"
 #include <fstream>
+#include <sstream>
 
 using namespace ph;
 
@@ -28,6 +29,30 @@ bool ph::Settings::save()
 	if (!settingsFile.is_open())
 		return false;
 
+	m_saveSettings(settingsFile);
+	settingsFile.close();
+	return true;
+}
+
+uint64_t ph::Settings::getHash() const
+{
+	// FNV-1a of the saved values, leaving out the checkpoint interval which doesn't change the outputs
+	Settings settings = *this;
+	settings.nCheckpointFrames = 0;
+	std::ostringstream os;
+	settings.m_saveSettings(os);
+
+	uint64_t nHash = 14695981039346656037ull;
+	for (char c : os.str())
+	{
+		nHash ^= (unsigned char)c;
+		nHash *= 1099511628211ull;
+	}
+	return nHash;
+}
+
+void ph::Settings::m_saveSettings(std::ostream& settingsFile) const
+{
 	m_saveSetting("BackgroundThreshold", nBackgroundThreshold, settingsFile);
 	m_saveSetting("OpenSize", nOpenSize, settingsFile);
 	m_saveSetting("OpenIter", nOpenIter, settingsFile);
@@ -55,9 +80,24 @@ bool ph::Settings::save()
 	m_saveSetting("InitStepSingle", fInitStepSingle, settingsFile);
 	m_saveSetting("InitStepGroup", fInitStepGroup, settingsFile);
 	m_saveSetting("OverlapPenalty", nOverlapPenalty, settingsFile);
-
-	settingsFile.close();
-	return true;
+	m_saveSetting("GroupInitMode", nGroupInitMode, settingsFile);
+	m_saveSetting("GroupInitMaxEvals", nGroupInitMaxEvals, settingsFile);
+	m_saveSetting("RecomputeConfidence", bRecomputeConfidence, settingsFile);
+
+	m_saveSetting("CalibrateMode", nCalibrateMode, settingsFile);
+	m_saveSetting("CalibrateStarts", nCalibrateStarts, settingsFile);
+	m_saveSetting("CalibrateRoundEvals", nCalibrateRoundEvals, settingsFile);
+	m_saveSetting("CalibrateMaxEvals", nCalibrateMaxEvals, settingsFile);
+	m_saveSetting("CalibrateFtolAbs", fCalibrateFtolAbs, settingsFile);
+	m_saveSetting("LinkTrajectories", bLinkTrajectories, settingsFile);
+	m_saveSetting("LinkMaxDisplacement", fLinkMaxDisplacement, settingsFile);
+	m_saveSetting("LinkMaxSubnetSize", nLinkMaxSubnetSize, settingsFile);
+	m_saveSetting("StatisticsBinSize", fStatisticsBinSize, settingsFile);
+	m_saveSetting("CheckpointFrames", nCheckpointFrames, settingsFile);
+	m_saveSetting("GenerateFrames", nGenerateFrames, settingsFile);
+	m_saveSetting("GenerateParticles", nGenerateParticles, settingsFile);
+	m_saveSetting("GenerateStep", fGenerateStep, settingsFile);
+	m_saveSetting("GenerateSeed", nGenerateSeed, settingsFile);
 }
 
 bool ph::Settings::m_setValue(const std::string& key, float value)
@@ -91,6 +131,24 @@ bool ph::Settings::m_setValue(const std::string& key, float value)
 	if (m_checkKey(key, "InitStepSingle", success)) fInitStepSingle = value;
 	if (m_checkKey(key, "InitStepGroup", success)) fInitStepGroup = value;
 	if (m_checkKey(key, "OverlapPenalty", success)) nOverlapPenalty = value;
+	if (m_checkKey(key, "GroupInitMode", success)) nGroupInitMode = value;
+	if (m_checkKey(key, "GroupInitMaxEvals", success)) nGroupInitMaxEvals = value;
+	if (m_checkKey(key, "RecomputeConfidence", success)) bRecomputeConfidence = value;
+
+	if (m_checkKey(key, "CalibrateMode", success)) nCalibrateMode = value;
+	if (m_checkKey(key, "CalibrateStarts", success)) nCalibrateStarts = value;
+	if (m_checkKey(key, "CalibrateRoundEvals", success)) nCalibrateRoundEvals = value;
+	if (m_checkKey(key, "CalibrateMaxEvals", success)) nCalibrateMaxEvals = value;
+	if (m_checkKey(key, "CalibrateFtolAbs", success)) fCalibrateFtolAbs = value;
+	if (m_checkKey(key, "LinkTrajectories", success)) bLinkTrajectories = value;
+	if (m_checkKey(key, "LinkMaxDisplacement", success)) fLinkMaxDisplacement = value;
+	if (m_checkKey(key, "LinkMaxSubnetSize", success)) nLinkMaxSubnetSize = value;
+	if (m_checkKey(key, "StatisticsBinSize", success)) fStatisticsBinSize = value;
+	if (m_checkKey(key, "CheckpointFrames", success)) nCheckpointFrames = value;
+	if (m_checkKey(key, "GenerateFrames", success)) nGenerateFrames = value;
+	if (m_checkKey(key, "GenerateParticles", success)) nGenerateParticles = value;
+	if (m_checkKey(key, "GenerateStep", success)) fGenerateStep = value;
+	if (m_checkKey(key, "GenerateSeed", success)) nGenerateSeed = value;
 
 	return success;
 }
@@ -101,7 +159,7 @@ bool ph::Settings::m_checkKey(const std::string& key, const std::string& name, b
 	return (key == name);
 }
 
-void ph::Settings::m_saveSetting(const std::string& name, float value, std::ofstream& file)
+void ph::Settings::m_saveSetting(const std::string& name, float value, std::ostream& file) const
 {
 	file << name << " " << value << std::endl;
 }
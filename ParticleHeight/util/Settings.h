@@ -1,5 +1,7 @@
 #pragma once
+#include <cstdint>
 #include <fstream>
+#include <ostream>
 
 namespace ph
 {
@@ -7,9 +9,25 @@ namespace ph
 	{
 		Settings() : m_file(nullptr) { m_initializeToDefaults(); };
 
+		// how the initial guess for each particle in an overlapping group is found
+		enum GroupInitMode
+		{
+			GROUP_INIT_SINGLE = 0,  // full single particle optimization, ignoring the neighbors
+			GROUP_INIT_CAPPED_SINGLE = 1,  // single particle optimization capped at nGroupInitMaxEvals evaluations
+			GROUP_INIT_PREVIOUS_FRAME = 2  // height of the nearest particle in the previous frame, capped single optimization if there is none
+		};
+
+		// how the optical parameters are calibrated
+		enum CalibrateMode
+		{
+			CALIBRATE_NELDERMEAD = 0,  // single Nelder-Mead run from the loaded parameters
+			CALIBRATE_MULTISTART = 1  // parallel short Nelder-Mead runs, with a quadratic surrogate proposing new candidates between rounds
+		};
+
 		void setFile(const char* file) { m_file = file; };
 		int load();
 		bool save();
+		uint64_t getHash() const;  // of the saved values, to check that a resumed run uses the same settings
 
 		// image processing parameters
 		int nBackgroundThreshold;
@@ -32,6 +50,33 @@ namespace ph
 		float fInitStepSingle;
 		float fInitStepGroup;
 		int nOverlapPenalty;  // coefficient for penalizing overlap during optimization
+		int nGroupInitMode;  // one of GroupInitMode
+		int nGroupInitMaxEvals;
+		bool bRecomputeConfidence;  // recompute group particle confidences with a separate correlation pass instead of using the optimizer's (for validation)
+
+		// calibration parameters
+		int nCalibrateMode;  // one of CalibrateMode
+		int nCalibrateStarts;  // parallel starts in multistart mode
+		int nCalibrateRoundEvals;  // evaluations per start in each round of multistart mode
+		int nCalibrateMaxEvals;  // total evaluation budget in multistart mode
+		float fCalibrateFtolAbs;  // SSR improvement below which the calibration stops
+
+		// trajectory linking parameters
+		bool bLinkTrajectories;  // add a particle id column to the csv output while processing
+		float fLinkMaxDisplacement;  // search range around the predicted position, in mm
+		int nLinkMaxSubnetSize;  // largest subnet solved exactly before its search range is reduced
+
+		// flow statistics parameters
+		float fStatisticsBinSize;  // width of the position bins of the profiles, in mm
+
+		// checkpoint parameters
+		int nCheckpointFrames;  // frames between the checkpoints of a run, 0 to turn them off
+
+		// synthetic video parameters
+		int nGenerateFrames;  // frames rendered when the positions are random
+		int nGenerateParticles;  // particles per frame when the positions are random
+		float fGenerateStep;  // standard deviation of each random particle's displacement per frame, in mm
+		int nGenerateSeed;
 
 		// experimental parameters
 		float fContactDistance;
@@ -69,12 +114,35 @@ namespace ph
 			fInitStepSingle = 0.1;
 			fInitStepGroup = 0.1;
 			nOverlapPenalty = 1000;
+			nGroupInitMode = GROUP_INIT_SINGLE;
+			nGroupInitMaxEvals = 20;
+			bRecomputeConfidence = false;
+
+			nCalibrateMode = CALIBRATE_NELDERMEAD;
+			nCalibrateStarts = 4;
+			nCalibrateRoundEvals = 20;
+			nCalibrateMaxEvals = 400;
+			fCalibrateFtolAbs = 0.0001;
+
+			bLinkTrajectories = false;
+			fLinkMaxDisplacement = 1.5;
+			nLinkMaxSubnetSize = 45;
+
+			fStatisticsBinSize = 0.1;
+
+			nCheckpointFrames = 1000;
+
+			nGenerateFrames = 100;
+			nGenerateParticles = 20;
+			fGenerateStep = 0.05;
+			nGenerateSeed = 1;
 
 			fContactDistance = 1.7;
 		};
 		bool m_setValue(const std::string& key, float value);
 		bool m_checkKey(const std::string& key, const std::string& name, bool& success);
-		void m_saveSetting(const std::string& name, float value, std::ofstream& file);
+		void m_saveSettings(std::ostream& file) const;
+		void m_saveSetting(const std::string& name, float value, std::ostream& file) const;
 	};
 }
 
@@ -0,0 +1,145 @@
+#include "TaskScheduler.h"
+#include <algorithm>
+#include <exception>
+
+using namespace ph;
+
+// the scheduler and index of the worker running on this thread, if any
+static thread_local const TaskScheduler* t_pScheduler = nullptr;
+static thread_local int t_nWorkerIndex = -1;
+
+ph::TaskScheduler::TaskScheduler(int nThreads) : m_nQueued(0), m_nNextQueue(0), m_bStop(false)
+{
+	nThreads = std::max(nThreads, 1);
+	for (int i = 0; i < nThreads; ++i)
+		m_vecQueues.emplace_back(new WorkerQueue());
+	for (int i = 0; i < nThreads; ++i)
+		m_vecThreads.emplace_back(&TaskScheduler::m_workerLoop, this, i);
+}
+
+ph::TaskScheduler::~TaskScheduler()
+{
+	// the workers finish the queued tasks before exiting
+	{
+		std::lock_guard<std::mutex> lock(m_mutexSleep);
+		m_bStop = true;
+	}
+	m_cvWork.notify_all();
+
+	for (auto& t : m_vecThreads)
+		t.join();
+}
+
+void ph::TaskScheduler::submit(TaskGroup& group, std::function<void()> task, float cost)
+{
+	group.m_nPending++;
+	group.m_nQueued++;
+
+	// workers queue their own subtasks, tasks from outside threads are spread over the workers
+	int index = m_getWorkerIndex();
+	if (index < 0)
+		index = m_nNextQueue++ % m_vecQueues.size();
+
+	{
+		// keep the queue sorted by decreasing cost, tasks of equal cost stay in submission order
+		WorkerQueue& q = *m_vecQueues[index];
+		std::lock_guard<std::mutex> lock(q.mutex);
+		auto it = std::find_if(q.tasks.begin(), q.tasks.end(), [cost](const Task& t) { return t.cost < cost; });
+		q.tasks.insert(it, Task{ std::move(task), cost, &group });
+	}
+
+	// waiting threads only take the tasks of their own group, so wake everyone to be sure the task is picked up
+	std::lock_guard<std::mutex> lock(m_mutexSleep);
+	m_nQueued++;
+	m_cvWork.notify_all();
+}
+
+void ph::TaskScheduler::wait(TaskGroup& group)
+{
+	// run the group's queued tasks until every task of the group is done, the other workers run the rest
+	int index = m_getWorkerIndex();
+	while (!group.isDone())
+	{
+		if (m_runTask(index, &group))
+			continue;
+
+		std::unique_lock<std::mutex> lock(m_mutexSleep);
+		m_cvWork.wait(lock, [&] { return group.isDone() || group.m_nQueued > 0; });
+	}
+
+	if (group.m_pException)
+	{
+		std::exception_ptr pException = group.m_pException;
+		group.m_pException = nullptr;
+		std::rethrow_exception(pException);
+	}
+}
+
+int ph::TaskScheduler::m_getWorkerIndex() const
+{
+	return (t_pScheduler == this) ? t_nWorkerIndex : -1;
+}
+
+bool ph::TaskScheduler::m_runTask(int index, const TaskGroup* pGroup)
+{
+	// take the largest task from our own queue, otherwise steal the largest task from another worker
+	// index is -1 for threads that aren't workers, they can only steal. if pGroup is set only its tasks are taken
+	Task task;
+	bool bFound = false;
+	int nQueues = (int)m_vecQueues.size();
+	for (int k = 0; k < nQueues && !bFound; ++k)
+	{
+		WorkerQueue& q = *m_vecQueues[(std::max(index, 0) + k) % nQueues];
+		std::lock_guard<std::mutex> lock(q.mutex);
+		auto it = (pGroup == nullptr) ? q.tasks.begin() : std::find_if(q.tasks.begin(), q.tasks.end(), [pGroup](const Task& t) { return t.group == pGroup; });
+		if (it != q.tasks.end())
+		{
+			task = std::move(*it);
+			q.tasks.erase(it);
+			task.group->m_nQueued--;
+			m_nQueued--;
+			bFound = true;
+		}
+	}
+
+	if (!bFound)
+		return false;
+
+	try
+	{
+		task.function();
+	}
+	catch (...)
+	{
+		// keep the first failure for whoever waits on the group
+		std::lock_guard<std::mutex> lock(m_mutexSleep);
+		if (!task.group->m_pException)
+			task.group->m_pException = std::current_exception();
+	}
+
+	if (--task.group->m_nPending == 0)
+	{
+		// wake up anyone waiting on this group
+		std::lock_guard<std::mutex> lock(m_mutexSleep);
+		m_cvWork.notify_all();
+	}
+
+	return true;
+}
+
+void ph::TaskScheduler::m_workerLoop(int index)
+{
+	t_pScheduler = this;
+	t_nWorkerIndex = index;
+
+	while (true)
+	{
+		if (m_runTask(index, nullptr))
+			continue;
+
+		std::unique_lock<std::mutex> lock(m_mutexSleep);
+		m_cvWork.wait(lock, [&] { return m_bStop || m_nQueued > 0; });
+		if (m_bStop && m_nQueued == 0)
+			return;
+	}
+}
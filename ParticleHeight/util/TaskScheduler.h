@@ -0,0 +1,67 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace ph
+{
+	class TaskGroup
+	{
+		// counts the outstanding tasks of one submitter so it can wait for them
+	public:
+		TaskGroup() : m_nPending(0), m_nQueued(0) {};
+		~TaskGroup() {};
+	public:
+		bool isDone() const { return m_nPending == 0; };
+	private:
+		std::atomic<int> m_nPending;
+		std::atomic<int> m_nQueued;  // tasks not started yet
+		std::exception_ptr m_pException;  // first exception thrown by one of the tasks, rethrown by wait
+		friend class TaskScheduler;
+	};
+
+	class TaskScheduler
+	{
+		// work-stealing thread pool for tasks with very different costs
+		// each worker keeps its tasks sorted largest cost first and runs them in that order, idle workers steal the largest task
+		// of another worker, and threads waiting on a task group run that group's tasks instead of blocking so tasks may submit and
+		// wait on subtasks. a waiting thread never starts other work, which would keep it from returning until that work is done
+	public:
+		TaskScheduler(int nThreads);
+		~TaskScheduler();
+	public:
+		void submit(TaskGroup& group, std::function<void()> task, float cost = 0);
+		void wait(TaskGroup& group);  // rethrows the first exception thrown by a task of the group
+		int getNumThreads() const { return (int)m_vecThreads.size(); };
+	private:
+		struct Task
+		{
+			std::function<void()> function;
+			float cost;
+			TaskGroup* group;
+		};
+		struct WorkerQueue
+		{
+			std::mutex mutex;
+			std::deque<Task> tasks;  // sorted by decreasing cost
+		};
+	private:
+		int m_getWorkerIndex() const;
+		bool m_runTask(int index, const TaskGroup* pGroup);
+		void m_workerLoop(int index);
+	private:
+		std::vector<std::unique_ptr<WorkerQueue>> m_vecQueues;  // one per worker
+		std::vector<std::thread> m_vecThreads;
+		std::mutex m_mutexSleep;
+		std::condition_variable m_cvWork;  // signalled when a task is queued or a task group finishes
+		std::atomic<int> m_nQueued;
+		std::atomic<unsigned> m_nNextQueue;  // round robin queue for tasks submitted by outside threads
+		bool m_bStop;
+	};
+}
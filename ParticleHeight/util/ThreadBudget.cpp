@@ -0,0 +1,30 @@
+#include "ThreadBudget.h"
+#include <opencv2/core/utility.hpp>
+#include <algorithm>
+#include <thread>
+
+using namespace ph;
+
+int ThreadBudget::m_nWorkerThreads = 1;
+int ThreadBudget::m_nOpenCVThreads = 1;
+int ThreadBudget::m_nMinParallelPixels = 256 * 256;
+
+void ph::ThreadBudget::configure(int nThreads, bool bConcurrentTasks)
+{
+	// nThreads <= 0 uses every hardware thread
+	// when the application runs tasks concurrently (e.g. several frames at once) each task gets one opencv thread, otherwise
+	// the application work is serial between the parallel sections and opencv can use all of the threads for full frame operations
+	// opencv's thread count is global so this should be called before any processing starts
+	if (nThreads <= 0)
+		nThreads = std::max(1, (int)std::thread::hardware_concurrency());
+
+	m_nWorkerThreads = nThreads;
+	m_nOpenCVThreads = bConcurrentTasks ? 1 : nThreads;
+	cv::setNumThreads(m_nOpenCVThreads);
+}
+
+void ph::ThreadBudget::printSummary(std::ostream& os)
+{
+	os << "thread budget: " << m_nWorkerThreads << " worker threads, " << m_nOpenCVThreads << " opencv threads, regions under "
+		<< m_nMinParallelPixels << " px transformed serially" << std::endl;
+}
@@ -0,0 +1,21 @@
+#pragma once
+#include <ostream>
+
+namespace ph
+{
+	class ThreadBudget
+	{
+		// splits the available threads between the application's task scheduler and opencv's internal parallelism
+		// so the two don't oversubscribe the cores
+	public:
+		static void configure(int nThreads, bool bConcurrentTasks);
+		static int getWorkerThreads() { return m_nWorkerThreads; };
+		static int getOpenCVThreads() { return m_nOpenCVThreads; };
+		static bool isParallelRegion(int nPixels) { return m_nOpenCVThreads > 1 && nPixels >= m_nMinParallelPixels; };
+		static void printSummary(std::ostream& os);
+	private:
+		static int m_nWorkerThreads;  // threads for the task scheduler
+		static int m_nOpenCVThreads;  // threads for full frame opencv operations (morphology, ECC, distance transform, ...)
+		static int m_nMinParallelPixels;  // regions smaller than this are always processed serially
+	};
+}
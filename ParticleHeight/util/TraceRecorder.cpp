@@ -0,0 +1,92 @@
+#include "TraceRecorder.h"
+#include <deque>
+#include <fstream>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+using namespace ph;
+
+std::atomic<bool> ph::TraceRecorder::m_bRecording(false);
+
+namespace
+{
+	struct threadBuffer
+	{
+		int nThread;
+		std::deque<ph::TraceEvent> events;  // only appended to by its own thread, a deque never moves what it holds
+	};
+
+	// every thread's buffer, kept until exit so the events outlive the threads that recorded them
+	std::mutex mutexBuffers;
+	std::vector<std::unique_ptr<threadBuffer>> vecBuffers;
+	std::chrono::steady_clock::time_point startTime;
+
+	threadBuffer* getThreadBuffer()
+	{
+		// the lock is only taken the first time a thread records
+		thread_local threadBuffer* pBuffer = nullptr;
+		if (pBuffer == nullptr)
+		{
+			std::lock_guard<std::mutex> lock(mutexBuffers);
+			vecBuffers.emplace_back(new threadBuffer());
+			pBuffer = vecBuffers.back().get();
+			pBuffer->nThread = (int)vecBuffers.size();
+		}
+		return pBuffer;
+	}
+}
+
+void ph::TraceRecorder::start()
+{
+	std::lock_guard<std::mutex> lock(mutexBuffers);
+	for (auto& pBuffer : vecBuffers)
+		pBuffer->events.clear();
+	startTime = std::chrono::steady_clock::now();
+	m_bRecording.store(true);
+}
+
+void ph::TraceRecorder::record(const char* sName, std::chrono::steady_clock::time_point beginTime, std::chrono::steady_clock::time_point endTime, int nFrame, int nParticles)
+{
+	if (!isRecording())
+		return;
+	getThreadBuffer()->events.push_back({ sName, beginTime, endTime, nFrame, nParticles });
+}
+
+bool ph::TraceRecorder::stop(const std::string& file)
+{
+	m_bRecording.store(false);
+
+	std::ofstream outFile(file);
+	if (!outFile.is_open())
+		return false;
+
+	// complete events ("X") with microsecond timestamps from the start of recording, one row per thread in the viewer
+	auto getMicroseconds = [](std::chrono::steady_clock::time_point t) { return std::chrono::duration<double, std::micro>(t - startTime).count(); };
+	std::lock_guard<std::mutex> lock(mutexBuffers);
+	outFile << std::fixed << std::setprecision(3);
+	outFile << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [";
+	bool bFirst = true;
+	for (auto& pBuffer : vecBuffers)
+	{
+		if (pBuffer->events.empty())
+			continue;
+		outFile << (bFirst ? "\n" : ",\n") << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": " << pBuffer->nThread
+			<< ", \"args\": {\"name\": \"thread " << pBuffer->nThread << "\"}}";
+		bFirst = false;
+		for (auto& e : pBuffer->events)
+		{
+			outFile << ",\n{\"name\": \"" << e.sName << "\", \"ph\": \"X\", \"pid\": 1, \"tid\": " << pBuffer->nThread
+				<< ", \"ts\": " << getMicroseconds(e.beginTime) << ", \"dur\": " << std::chrono::duration<double, std::micro>(e.endTime - e.beginTime).count()
+				<< ", \"args\": {";
+			if (e.nFrame >= 0)
+				outFile << "\"frame\": " << e.nFrame << (e.nParticles > 0 ? ", " : "");
+			if (e.nParticles > 0)
+				outFile << "\"particles\": " << e.nParticles;
+			outFile << "}}";
+		}
+	}
+	outFile << "\n]}\n";
+	return (bool)outFile;
+}
@@ -0,0 +1,50 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <string>
+
+namespace ph
+{
+	// one span of work on a thread, names must be string literals since only the pointer is kept
+	struct TraceEvent
+	{
+		const char* sName;
+		std::chrono::steady_clock::time_point beginTime;
+		std::chrono::steady_clock::time_point endTime;
+		int nFrame;  // -1 if not tied to a frame
+		int nParticles;  // 0 if not a particle solve
+	};
+
+	class TraceRecorder
+	{
+		// records spans of work from every thread into buffers owned by each thread, so appending an event takes no lock
+		// the events are written as chrome trace event json (chrome://tracing or ui.perfetto.dev) once the threads are done
+	public:
+		static void start();
+		static bool isRecording() { return m_bRecording.load(std::memory_order_relaxed); };
+		static void record(const char* sName, std::chrono::steady_clock::time_point beginTime, std::chrono::steady_clock::time_point endTime, int nFrame = -1, int nParticles = 0);
+		static bool stop(const std::string& file);  // call once no thread is recording
+	private:
+		static std::atomic<bool> m_bRecording;
+	};
+
+	class TraceScope
+	{
+		// records the time between its construction and destruction, does nothing unless the recorder is started
+	public:
+		TraceScope(const char* sName, int nFrame = -1, int nParticles = 0) : m_sName(sName), m_nFrame(nFrame), m_nParticles(nParticles), m_bRecording(TraceRecorder::isRecording())
+		{
+			if (m_bRecording) m_beginTime = std::chrono::steady_clock::now();
+		};
+		~TraceScope()
+		{
+			if (m_bRecording) TraceRecorder::record(m_sName, m_beginTime, std::chrono::steady_clock::now(), m_nFrame, m_nParticles);
+		};
+	private:
+		const char* m_sName;
+		int m_nFrame;
+		int m_nParticles;
+		bool m_bRecording;
+		std::chrono::steady_clock::time_point m_beginTime;
+	};
+}